@@ -0,0 +1,214 @@
+// Counts global heap allocations on the keep-alive path of http_session.
+// Each iteration drives session_memory the way the session does for one
+// request: next_request() empties the arena and constructs the parser, the
+// request is parsed from the session's read buffer, a large body goes to the
+// shared body pool, and the response is built with make_response(), held
+// with hold() like write() does, serialized and released.
+// After a warm-up the count per request has to be zero.
+//
+//   g++ -std=c++17 -O2 -Wall -Wextra -I../src arena_allocations.cpp ../src/beast.cpp -o arena_allocations -lpthread
+
+#include "session_memory.hpp"
+#include <boost/beast/version.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <new>
+
+namespace {
+
+std::atomic<std::size_t> allocations{ 0 };
+
+char const* const requests[] = {
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:91.0) Gecko/20100101 Firefox/91.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "GET /ready HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n",
+
+    "POST /broker/send?room=r&from=a&to=b HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 58\r\n"
+    "\r\n"
+    "{\"type\":\"candidate\",\"candidate\":\"candidate:1 1 udp 1 a 9\"}",
+};
+
+[[noreturn]] void fail(char const* what, beast::error_code const& ec)
+{
+    std::fprintf(stderr, "%s: %s\n", what, ec.message().c_str());
+    std::exit(2);
+}
+
+// Feed the read buffer to the parser until it stops, like async_read_header and async_read
+void parse(session_buffer& buffer, session_parser& parser, bool (session_parser::*done)() const)
+{
+    beast::error_code ec;
+    while (!(parser.*done)() && buffer.size() > 0)
+    {
+        buffer.consume(parser.put(buffer.data(), ec));
+        if (ec)
+            fail("parse", ec);
+    }
+}
+
+// Write a held response the way async_write_some would, without a socket
+template <class Body>
+std::size_t serialize(outgoing<Body>& out)
+{
+    std::size_t bytes = 0;
+    beast::error_code ec;
+    while (!out.sr.is_done() && !ec)
+    {
+        out.sr.next(ec, [&](beast::error_code&, auto const& buffers)
+            {
+                bytes += net::buffer_size(buffers);
+                out.sr.consume(net::buffer_size(buffers));
+            });
+    }
+    if (ec)
+        fail("serialize", ec);
+    return bytes;
+}
+
+// One request on a keep-alive connection
+std::size_t serve(
+    session_memory& memory,
+    std::pmr::memory_resource* body_pool,
+    char const* doc_root,
+    char const* text)
+{
+    auto& parser = memory.next_request();
+    parser.body_limit(64 * 1024);
+
+    // The bytes arrive in the session's read buffer
+    auto& buffer = memory.buffer();
+    auto const size = std::strlen(text);
+    buffer.commit(net::buffer_copy(buffer.prepare(size), net::buffer(text, size)));
+
+    parse(buffer, parser, &session_parser::is_header_done);
+
+    // POST bodies go to the shared pool, as limits_for picks for /broker/send
+    if (parser.get().method() == http::verb::post)
+        memory.use_body_pool(body_pool);
+
+    parse(buffer, parser, &session_parser::is_done);
+    if (!parser.is_done())
+        fail("parse", http::error::partial_message);
+    auto const& req = parser.get();
+
+    std::size_t bytes = 0;
+    if (req.target() == "/index.html")
+    {
+        auto const path = path_cat(doc_root, req.target(), memory.allocator());
+        beast::error_code ec;
+        http::file_body::value_type body;
+        body.open(path.c_str(), beast::file_mode::scan, ec);
+        if (ec)
+            fail("open", ec);
+        auto const size = body.size();
+        auto res = memory.make_response<http::file_body>(http::status::ok, req.version());
+        res.body() = std::move(body);
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, mime_type(path));
+        res.set(http::field::accept_ranges, "bytes");
+        res.content_length(size);
+        res.keep_alive(req.keep_alive());
+        bytes = serialize(memory.hold(std::move(res)));
+    }
+    else
+    {
+        auto res = memory.make_response<arena_string_body>(http::status::ok, req.version());
+        res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+        res.set(http::field::content_type, "text/plain");
+        res.set(http::field::cache_control, "no-store");
+        res.keep_alive(req.keep_alive());
+        res.body().assign(req.body().data(), req.body().size());
+        res.body().append(512, '.');
+        res.prepare_payload();
+        bytes = serialize(memory.hold(std::move(res)));
+    }
+
+    // Done writing, as in on_write
+    memory.release_response();
+    return bytes;
+}
+
+void* counted_malloc(std::size_t size)
+{
+    ++allocations;
+    if (auto p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* counted_aligned_alloc(std::size_t size, std::align_val_t alignment)
+{
+    ++allocations;
+    auto const align = static_cast<std::size_t>(alignment);
+    if (auto p = std::aligned_alloc(align, (size + align - 1) / align * align))
+        return p;
+    throw std::bad_alloc();
+}
+
+}
+
+// Every form of the global operator new is counted, and all of them free()
+void* operator new(std::size_t size) { return counted_malloc(size); }
+void* operator new[](std::size_t size) { return counted_malloc(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return counted_aligned_alloc(size, alignment); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return counted_aligned_alloc(size, alignment); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+int main(int argc, char* argv[])
+{
+    auto const iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+
+    // A document root with the file the GET request asks for
+    auto const doc_root = std::filesystem::temp_directory_path().string();
+    std::ofstream(doc_root + "/index.html") << std::string(4096, 'x');
+
+    // The session's memory, and the body pool shared_state sets up
+    memory_budget budget(1024 * 1024 * 1024);
+    counting_resource body_counting(budget, memory_subsystem::http_buffers);
+    std::pmr::synchronized_pool_resource body_pool(std::pmr::pool_options{ 4, 256 * 1024 }, &body_counting);
+    session_memory memory(budget);
+
+    // The first requests fill the pools with the blocks they need
+    std::size_t bytes = 0;
+    for (int i = 0; i < 16; ++i)
+        bytes += serve(memory, &body_pool, doc_root.c_str(), requests[i % 3]);
+    auto const warm_up = allocations.load();
+
+    auto const start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        bytes += serve(memory, &body_pool, doc_root.c_str(), requests[i % 3]);
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    auto const steady = allocations.load() - warm_up;
+
+    std::printf("warm-up allocations:       %zu\n", warm_up);
+    std::printf("steady state allocations:  %zu in %d requests\n", steady, iterations);
+    std::printf("requests per second:       %.0f (%zu bytes)\n", iterations / elapsed, bytes);
+    std::printf("http_buffers charged:      %llu bytes\n",
+        static_cast<unsigned long long>(budget.used(memory_subsystem::http_buffers)));
+    return steady == 0 ? 0 : 1;
+}
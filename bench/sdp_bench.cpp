@@ -0,0 +1,87 @@
+// Checks parse_sdp against sdp_corpus/ and times parse_sdp and build_answer.
+// Files named valid_* must be accepted and malformed_* rejected.
+//
+//   g++ -std=c++17 -O2 -I../src sdp_bench.cpp ../src/sdp.cpp -o sdp_bench
+//   ./sdp_bench sdp_corpus
+
+#include "sdp.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Run f often enough to measure it, and return nanoseconds per call
+template <class Function>
+double time_per_call(Function&& f)
+{
+    using clock = std::chrono::steady_clock;
+    std::size_t calls = 0;
+    auto const start = clock::now();
+    auto elapsed = clock::duration::zero();
+    while (elapsed < std::chrono::milliseconds(200))
+    {
+        for (int i = 0; i < 100; ++i)
+            f();
+        calls += 100;
+        elapsed = clock::now() - start;
+    }
+    return std::chrono::duration<double, std::nano>(elapsed).count() / calls;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+    std::filesystem::path const dir = argc > 1 ? argv[1] : "sdp_corpus";
+
+    std::vector<std::filesystem::path> files;
+    for (auto const& entry : std::filesystem::directory_iterator(dir))
+        files.push_back(entry.path());
+    std::sort(files.begin(), files.end());
+
+    // Candidates for the answers, spread over the first m-sections
+    std::vector<sdp_candidate> candidates;
+    for (int i = 0; i < 8; ++i)
+        candidates.push_back({ i % 3, "candidate:" + std::to_string(i) +
+            " 1 udp 2122260223 192.0.2." + std::to_string(i) + " 5000" + std::to_string(i) + " typ host" });
+
+    int failures = 0;
+    std::printf("%-40s %8s %12s %12s\n", "file", "bytes", "parse ns", "answer ns");
+    for (auto const& path : files)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::string const text{ std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>() };
+        auto const name = path.filename().string();
+        bool const valid = name.rfind("valid_", 0) == 0;
+
+        sdp_description description;
+        std::string error;
+        auto const accepted = parse_sdp(text, description, error);
+        if (accepted != valid)
+        {
+            std::printf("%-40s %s: %s\n", name.c_str(),
+                accepted ? "accepted" : "rejected", accepted ? "expected a rejection" : error.c_str());
+            ++failures;
+            continue;
+        }
+
+        auto const parse_ns = time_per_call([&] { parse_sdp(text, description, error); });
+        if (!valid)
+        {
+            std::printf("%-40s %8zu %12.0f %12s  (%s)\n", name.c_str(), text.size(), parse_ns, "-", error.c_str());
+            continue;
+        }
+
+        std::size_t answer_size = 0;
+        auto const answer_ns = time_per_call([&] { answer_size += build_answer(text, candidates).size(); });
+        std::printf("%-40s %8zu %12.0f %12.0f  (%zu media, %.0f MB/s)\n", name.c_str(), text.size(),
+            parse_ns, answer_ns, description.media.size(), text.size() / parse_ns * 1000);
+    }
+    return failures == 0 ? 0 : 1;
+}
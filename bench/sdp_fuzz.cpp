@@ -0,0 +1,162 @@
+// Fuzz target for parse_sdp and build_answer, seeded with sdp_corpus/.
+//
+// With libFuzzer:
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -DSDP_FUZZ_LIBFUZZER -I../src sdp_fuzz.cpp ../src/sdp.cpp -o sdp_fuzz
+//   ./sdp_fuzz sdp_corpus
+//
+// Without it, a small built-in mutator runs over the given seed files:
+//   g++ -std=c++17 -g -O1 -fsanitize=address,undefined -I../src sdp_fuzz.cpp ../src/sdp.cpp -o sdp_fuzz
+//   ./sdp_fuzz sdp_corpus/*
+// SDP_FUZZ_RUNS and SDP_FUZZ_SEED set the number of mutated inputs and the random seed.
+
+#include "sdp.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+void check(bool condition, char const* what)
+{
+    if (!condition)
+    {
+        std::fprintf(stderr, "invariant violated: %s\n", what);
+        std::abort();
+    }
+}
+
+// Whether a view points into text, as the parser promises
+bool inside(std::string_view view, std::string_view text)
+{
+    return view.empty() ||
+        (view.data() >= text.data() && view.data() + view.size() <= text.data() + text.size());
+}
+
+}
+
+extern "C" int LLVMFuzzerTestOneInput(std::uint8_t const* data, std::size_t size)
+{
+    std::string_view const text(reinterpret_cast<char const*>(data), size);
+
+    sdp_description description;
+    std::string error;
+    if (parse_sdp(text, description, error))
+    {
+        check(error.empty(), "accepted with an error");
+        check(!description.media.empty(), "accepted without media");
+        check(description.media.size() <= max_sdp_media, "too many media sections");
+        check(inside(description.fingerprint, text) && inside(description.ice_ufrag, text) &&
+            inside(description.ice_pwd, text), "session view outside the input");
+        for (auto const& media : description.media)
+            check(inside(media.kind, text) && inside(media.protocol, text) && inside(media.mid, text) &&
+                inside(media.fingerprint, text) && inside(media.ice_ufrag, text) &&
+                inside(media.ice_pwd, text), "media view outside the input");
+    }
+    else
+        check(!error.empty(), "rejected without a reason");
+
+    // Every candidate ends up in the answer exactly once, known m-section or not
+    std::vector<sdp_candidate> const candidates{
+        { 0, "candidate:1 1 udp 2122260223 192.0.2.1 50000 typ host" },
+        { 1, "candidate:2 1 udp 2122260223 192.0.2.1 50001 typ host" },
+        { -1, "candidate:3 1 udp 1686052607 198.51.100.7 50002 typ srflx" },
+        { 40, "candidate:4 1 tcp 1518280447 192.0.2.1 9 typ host tcptype active" } };
+    auto const answer = build_answer(text, candidates);
+    for (auto const& c : candidates)
+    {
+        auto const line = "a=" + c.line + "\r\n";
+        auto const first = answer.find(line);
+        check(first != std::string::npos, "candidate missing from the answer");
+        check(answer.find(line, first + 1) == std::string::npos, "candidate added twice");
+    }
+    return 0;
+}
+
+#if !defined(SDP_FUZZ_LIBFUZZER)
+
+// Replay the seeds, then mutate them: flip, insert and delete bytes,
+// duplicate and drop lines, splice in parts of other seeds
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> seeds;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::ifstream file(argv[i], std::ios::binary);
+        seeds.emplace_back(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    if (seeds.empty())
+    {
+        std::fprintf(stderr, "usage: %s <seed files>\n", argv[0]);
+        return 1;
+    }
+
+    auto const iterations = std::getenv("SDP_FUZZ_RUNS") ? std::atol(std::getenv("SDP_FUZZ_RUNS")) : 100000L;
+    std::mt19937_64 rng(std::getenv("SDP_FUZZ_SEED") ? std::atoll(std::getenv("SDP_FUZZ_SEED")) : 1);
+    auto const pick = [&rng](std::size_t n) { return n ? static_cast<std::size_t>(rng() % n) : 0; };
+    char const interesting[] = { '\r', '\n', ' ', '=', ':', 'm', 'a', 'v', '0', '9', '\0', '\x7f', '\xff' };
+
+    auto const run = [](std::string const& input)
+    {
+        LLVMFuzzerTestOneInput(reinterpret_cast<std::uint8_t const*>(input.data()), input.size());
+    };
+    for (auto const& seed : seeds)
+        run(seed);
+
+    for (long i = 0; i < iterations; ++i)
+    {
+        auto input = seeds[pick(seeds.size())];
+        for (auto n = 1 + pick(4); n > 0; --n)
+        {
+            switch (pick(6))
+            {
+            case 0:
+                if (!input.empty())
+                    input[pick(input.size())] ^= static_cast<char>(1 << pick(8));
+                break;
+            case 1:
+                input.insert(pick(input.size() + 1), 1, interesting[pick(sizeof(interesting))]);
+                break;
+            case 2:
+                if (!input.empty())
+                {
+                    auto const at = pick(input.size());
+                    input.erase(at, 1 + pick(input.size() - at));
+                }
+                break;
+            case 3:
+            {
+                // Duplicate a line, up to many times
+                auto const end = input.find('\n', pick(input.size() + 1));
+                auto const last = end == std::string::npos ? input.size() : end + 1;
+                auto const start = last < 2 ? std::string::npos : input.rfind('\n', last - 2);
+                auto const from = start == std::string::npos ? 0 : start + 1;
+                auto const line = input.substr(from, last - from);
+                for (auto k = pick(64); k > 0; --k)
+                    input.insert(from, line);
+                break;
+            }
+            case 4:
+            {
+                auto const& other = seeds[pick(seeds.size())];
+                auto const from = pick(other.size() + 1);
+                input.insert(pick(input.size() + 1), other.substr(from, pick(other.size() - from + 1)));
+                break;
+            }
+            default:
+                input.resize(pick(input.size() + 1));
+                break;
+            }
+        }
+        run(input);
+    }
+
+    std::printf("%zu seeds, %ld mutated inputs, no invariant violated\n", seeds.size(), iterations);
+    return 0;
+}
+
+#endif
@@ -1,4 +1,7 @@
 #include "beast.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
 
 // Return a reasonable mime type based on the extension of a file.
 beast::string_view mime_type(beast::string_view path)
@@ -35,29 +38,162 @@ beast::string_view mime_type(beast::string_view path)
     return "application/text";
 }
 
-// Append an HTTP rel-path to a local filesystem path.
-// The returned path is normalized for the platform.
-std::string
-path_cat(
-    beast::string_view base,
-    beast::string_view path)
+
+// Return the path of a request target, without the query
+beast::string_view target_path(beast::string_view target)
+{
+    return target.substr(0, target.find('?'));
+}
+
+// Return the value of a query parameter of a request target, or an empty view
+beast::string_view query_param(beast::string_view target, beast::string_view name)
+{
+    auto const pos = target.find('?');
+    if (pos == beast::string_view::npos)
+        return {};
+    auto query = target.substr(pos + 1);
+    while (!query.empty())
+    {
+        auto const amp = query.find('&');
+        auto const pair = query.substr(0, amp);
+        auto const eq = pair.find('=');
+        if (pair.substr(0, eq) == name)
+            return eq == beast::string_view::npos ? beast::string_view{} : pair.substr(eq + 1);
+        if (amp == beast::string_view::npos)
+            break;
+        query.remove_prefix(amp + 1);
+    }
+    return {};
+}
+
+// Parse the byte ranges of a Range header field for a file of the given size.
+// Satisfiable ranges are returned as (first, length) pairs.
+range_result parse_range(
+    beast::string_view field,
+    std::uint64_t size,
+    std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges)
+{
+    // Refuse to split a response into an unreasonable number of parts
+    std::size_t constexpr max_ranges = 16;
+
+    // Only byte ranges are supported
+    if (field.substr(0, 6) != "bytes=")
+        return range_result::none;
+    field.remove_prefix(6);
+
+    auto const trim = [](beast::string_view s)
+    {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+            s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+            s.remove_suffix(1);
+        return s;
+    };
+
+    // Parse a non-empty run of digits
+    auto const number = [](beast::string_view s, std::uint64_t& n)
+    {
+        if (s.empty() || s.size() > 19)
+            return false;
+        n = 0;
+        for (auto c : s)
+        {
+            if (c < '0' || c > '9')
+                return false;
+            n = n * 10 + (c - '0');
+        }
+        return true;
+    };
+
+    ranges.clear();
+    std::size_t count = 0;
+    while (!field.empty())
+    {
+        auto const comma = field.find(',');
+        auto const spec = trim(field.substr(0, comma));
+        field = comma == beast::string_view::npos ?
+            beast::string_view{} : field.substr(comma + 1);
+        if (spec.empty())
+            continue;
+        if (++count > max_ranges)
+            return range_result::none;
+
+        auto const dash = spec.find('-');
+        if (dash == beast::string_view::npos)
+            return range_result::none;
+        auto const first_str = spec.substr(0, dash);
+        auto const last_str = spec.substr(dash + 1);
+
+        std::uint64_t first, last;
+        if (first_str.empty())
+        {
+            // Suffix range: the final N bytes
+            if (!number(last_str, last))
+                return range_result::none;
+            if (last == 0 || size == 0)
+                continue;
+            if (last > size)
+                last = size;
+            ranges.emplace_back(size - last, last);
+            continue;
+        }
+
+        if (!number(first_str, first))
+            return range_result::none;
+        if (last_str.empty())
+            last = ~std::uint64_t{};
+        else if (!number(last_str, last) || last < first)
+            return range_result::none;
+
+        // Ranges starting past the end can't be served
+        if (first >= size)
+            continue;
+        if (last >= size)
+            last = size - 1;
+        ranges.emplace_back(first, last - first + 1);
+    }
+
+    if (count == 0)
+        return range_result::none;
+    if (ranges.empty())
+        return range_result::unsatisfiable;
+
+    // Coalesce overlapping and adjacent ranges, so the response
+    // never carries a byte twice or more than the file itself
+    std::sort(ranges.begin(), ranges.end());
+    auto merged = ranges.begin();
+    for (auto it = ranges.begin() + 1; it != ranges.end(); ++it)
+    {
+        auto const end = merged->first + merged->second;
+        if (it->first <= end)
+            merged->second = std::max(end, it->first + it->second) - merged->first;
+        else
+            *++merged = *it;
+    }
+    ranges.erase(merged + 1, ranges.end());
+    return range_result::satisfiable;
+}
+
+// Build a strong entity tag from the size and modification time of a file.
+// The tag is written into buf, which must outlive the returned view.
+beast::string_view file_etag(
+    char const* path,
+    std::uint64_t size,
+    char* buf,
+    std::size_t buf_size)
 {
-    if (base.empty())
-        return std::string(path);
-    std::string result(base);
 #ifdef BOOST_MSVC
-    char constexpr path_separator = '\\';
-    if (result.back() == path_separator)
-        result.resize(result.size() - 1);
-    result.append(path.data(), path.size());
-    for (auto& c : result)
-        if (c == '/')
-            c = path_separator;
+    struct _stat64 st;
+    auto const mtime = _stat64(path, &st) == 0 ? st.st_mtime : 0;
 #else
-    char constexpr path_separator = '/';
-    if (result.back() == path_separator)
-        result.resize(result.size() - 1);
-    result.append(path.data(), path.size());
+    struct stat st;
+    auto const mtime = ::stat(path, &st) == 0 ? st.st_mtime : 0;
 #endif
-    return result;
+    auto const n = std::snprintf(buf, buf_size, "\"%llx-%llx\"",
+        static_cast<unsigned long long>(size),
+        static_cast<unsigned long long>(mtime));
+    if (n < 0)
+        return {};
+    return { buf, static_cast<std::size_t>(n) < buf_size ?
+        static_cast<std::size_t>(n) : buf_size - 1 };
 }
\ No newline at end of file
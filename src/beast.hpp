@@ -4,8 +4,11 @@
 #include <boost/beast/http.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
+#include <cstdint>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -22,9 +25,66 @@ void fail(ErrorCode ec, String what)
 // Return a reasonable mime type based on the extension of a file.
 beast::string_view mime_type(beast::string_view path);
 
+// Return the path of a request target, without the query
+beast::string_view target_path(beast::string_view target);
+
+// Return the value of a query parameter of a request target, or an empty view
+beast::string_view query_param(beast::string_view target, beast::string_view name);
+
+// Outcome of matching a Range header field against a file
+enum class range_result
+{
+    // No usable Range, send the whole file
+    none,
+    // At least one range can be served
+    satisfiable,
+    // None of the ranges overlap the file
+    unsatisfiable
+};
+
+// Parse the byte ranges of a Range header field for a file of the given size.
+// Satisfiable ranges are returned as (first, length) pairs in ascending order,
+// with overlapping and adjacent ranges merged.
+range_result parse_range(
+    beast::string_view field,
+    std::uint64_t size,
+    std::vector<std::pair<std::uint64_t, std::uint64_t>>& ranges);
+
+// Build a strong entity tag from the size and modification time of a file.
+// The tag is written into buf, which must outlive the returned view.
+beast::string_view file_etag(
+    char const* path,
+    std::uint64_t size,
+    char* buf,
+    std::size_t buf_size);
+
 // Append an HTTP rel-path to a local filesystem path.
 // The returned path is normalized for the platform.
-std::string
+template <class Allocator = std::allocator<char>>
+std::basic_string<char, std::char_traits<char>, Allocator>
 path_cat(
     beast::string_view base,
-    beast::string_view path);
\ No newline at end of file
+    beast::string_view path,
+    Allocator const& alloc = Allocator{})
+{
+    std::basic_string<char, std::char_traits<char>, Allocator> result(alloc);
+    if (base.empty())
+        return result.assign(path.data(), path.size());
+    result.reserve(base.size() + path.size());
+    result.assign(base.data(), base.size());
+#ifdef BOOST_MSVC
+    char constexpr path_separator = '\\';
+    if (result.back() == path_separator)
+        result.resize(result.size() - 1);
+    result.append(path.data(), path.size());
+    for (auto& c : result)
+        if (c == '/')
+            c = path_separator;
+#else
+    char constexpr path_separator = '/';
+    if (result.back() == path_separator)
+        result.resize(result.size() - 1);
+    result.append(path.data(), path.size());
+#endif
+    return result;
+}
\ No newline at end of file
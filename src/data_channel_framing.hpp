@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+// WebRTC headers
+#include <webrtc/api/array_view.h>
+#include <webrtc/api/datachannelinterface.h>
+#include <webrtc/rtc_base/copyonwritebuffer.h>
+#include <webrtc/rtc_base/thread.h>
+
+// Binary data channel messages carry one or more frames.
+// Each frame is its payload length as a LEB128 varint, followed by the payload,
+// so a tiny message costs a single byte of framing.
+
+// Largest payload accepted in a single frame
+std::size_t constexpr max_frame_size = 1 << 20;
+
+// Longest length prefix of a frame
+std::size_t constexpr max_frame_prefix = 5;
+
+// Append one length-prefixed frame to a buffer
+inline void append_frame(rtc::CopyOnWriteBuffer& out, const uint8_t* data, std::size_t size)
+{
+    uint8_t prefix[max_frame_prefix];
+    std::size_t n = 0;
+    auto length = static_cast<uint32_t>(size);
+    do
+    {
+        prefix[n] = static_cast<uint8_t>(length & 0x7f);
+        length >>= 7;
+        if (length)
+            prefix[n] |= 0x80;
+        ++n;
+    } while (length);
+    out.AppendData(prefix, n);
+    out.AppendData(data, size);
+}
+
+// Call f with a view of every frame in a buffer, without copying the payloads.
+// Returns false if the buffer holds a malformed frame; frames before it are still delivered.
+template <class Function>
+bool for_each_frame(const rtc::CopyOnWriteBuffer& in, Function&& f)
+{
+    auto p = in.data<uint8_t>();
+    auto const end = p + in.size();
+    while (p != end)
+    {
+        // Decode the length prefix
+        uint32_t length = 0;
+        int shift = 0;
+        while (true)
+        {
+            if (p == end || shift >= 7 * static_cast<int>(max_frame_prefix))
+                return false;
+            auto const byte = *p++;
+            // The fifth byte holds the top 4 bits of a 32-bit length, and ends the prefix
+            if (shift == 28 && byte > 0x0f)
+                return false;
+            length |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                break;
+            shift += 7;
+        }
+
+        if (length > max_frame_size || static_cast<std::size_t>(end - p) < length)
+            return false;
+        f(rtc::ArrayView<const uint8_t>(p, length));
+        p += length;
+    }
+    return true;
+}
+
+// Flush policy for message_coalescer
+struct coalescer_config
+{
+    // Send the batch once it holds this many bytes
+    std::size_t max_bytes = 16 * 1024;
+
+    // Send a partial batch this long after its first message
+    int flush_window_ms = 5;
+};
+
+// Batches small messages into one binary DataBuffer per flush,
+// so many tiny messages share a single SCTP message
+class message_coalescer : public rtc::MessageHandler
+{
+    // Receives each finished batch
+    std::function<void(const webrtc::DataBuffer&)> sink_;
+    rtc::Thread* thread_;
+    coalescer_config const config_;
+
+    // This mutex synchronizes access to the pending batch
+    std::mutex mutex_;
+    rtc::CopyOnWriteBuffer pending_;
+    bool flush_scheduled_ = false;
+
+    // Held from taking a batch until the sink has it, so batches taken on
+    // different threads reach the sink in order. Locked before mutex_.
+    std::mutex sink_mutex_;
+
+public:
+    message_coalescer(
+        std::function<void(const webrtc::DataBuffer&)> sink,
+        rtc::Thread* thread,
+        coalescer_config const& config)
+        : sink_(std::move(sink))
+        , thread_(thread)
+        , config_(config)
+    {
+    }
+
+    ~message_coalescer()
+    {
+        // Drop a pending flush timer
+        thread_->Clear(this);
+    }
+
+    // Queue one message, returns false if it is too large to frame
+    bool send(const uint8_t* data, std::size_t size)
+    {
+        if (size > max_frame_size)
+            return false;
+
+        // Batches reach the sink in the order they were taken, whichever thread sends
+        std::lock_guard<std::mutex> order(sink_mutex_);
+        rtc::CopyOnWriteBuffer previous, full;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+
+            // Close the current batch if this message would overflow it
+            if (pending_.size() > 0 && pending_.size() + size + max_frame_prefix > config_.max_bytes)
+                previous = take_pending();
+
+            append_frame(pending_, data, size);
+
+            if (pending_.size() >= config_.max_bytes)
+                full = take_pending();
+            else if (!flush_scheduled_)
+            {
+                flush_scheduled_ = true;
+                thread_->PostDelayed(RTC_FROM_HERE, config_.flush_window_ms, this);
+            }
+        }
+        send_buffer(std::move(previous));
+        send_buffer(std::move(full));
+        return true;
+    }
+
+    // Send the pending batch now
+    void flush()
+    {
+        std::lock_guard<std::mutex> order(sink_mutex_);
+        rtc::CopyOnWriteBuffer ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready = take_pending();
+        }
+        send_buffer(std::move(ready));
+    }
+
+private:
+    // Flush window expired
+    void OnMessage(rtc::Message*) override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            flush_scheduled_ = false;
+        }
+        flush();
+    }
+
+    rtc::CopyOnWriteBuffer take_pending()
+    {
+        rtc::CopyOnWriteBuffer ready;
+        std::swap(ready, pending_);
+        return ready;
+    }
+
+    // Called with sink_mutex_ held but not mutex_. The sink must not block on
+    // the signaling thread, whose flush timer waits for sink_mutex_.
+    void send_buffer(rtc::CopyOnWriteBuffer&& buffer)
+    {
+        if (buffer.size() > 0)
+            sink_(webrtc::DataBuffer(buffer, true));
+    }
+};
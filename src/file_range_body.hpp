@@ -0,0 +1,133 @@
+#pragma once
+
+#include "beast.hpp"
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A response body which sends one or more byte ranges of an open file.
+// A single range is sent as-is; several ranges are sent as the parts of
+// a multipart/byteranges body, each part preceded by its own header.
+// The file is read in bounded chunks, so memory use does not depend on
+// the size of the ranges.
+struct file_range_body
+{
+    // One byte range of the file, with the text written before it
+    struct part
+    {
+        std::string head;
+        std::uint64_t first = 0;
+        std::uint64_t length = 0;
+    };
+
+    class value_type
+    {
+        friend struct file_range_body;
+
+        beast::file file_;
+        std::vector<part> parts_;
+        std::string tail_;
+
+    public:
+        // Take ownership of an open file
+        void reset(beast::file&& file) { file_ = std::move(file); }
+
+        // Append a range of the file, preceded by head
+        void add(std::string head, std::uint64_t first, std::uint64_t length)
+        {
+            parts_.push_back({ std::move(head), first, length });
+        }
+
+        // Set the text written after the last range
+        void tail(std::string tail) { tail_ = std::move(tail); }
+    };
+
+    // Return the number of bytes in the body
+    static std::uint64_t size(value_type const& body)
+    {
+        std::uint64_t n = body.tail_.size();
+        for (auto const& p : body.parts_)
+            n += p.head.size() + p.length;
+        return n;
+    }
+
+    class writer
+    {
+        value_type& body_;
+        std::size_t index_ = 0;     // The part being sent
+        bool head_sent_ = false;    // The current part's head is sent
+        bool seeked_ = false;       // The file is positioned at the current part
+        bool tail_sent_ = false;    // The text after the last part is sent
+        std::uint64_t remain_ = 0;  // Unread bytes of the current part
+        char buf_[16384];           // Bounded buffer for reading
+
+    public:
+        using const_buffers_type = net::const_buffer;
+
+        template <bool isRequest, class Fields>
+        writer(http::header<isRequest, Fields>&, value_type& body)
+            : body_(body)
+        {
+        }
+
+        void init(beast::error_code& ec)
+        {
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(beast::error_code& ec)
+        {
+            ec = {};
+            while (index_ < body_.parts_.size())
+            {
+                auto const& p = body_.parts_[index_];
+
+                if (!head_sent_)
+                {
+                    head_sent_ = true;
+                    if (!p.head.empty())
+                        return { { net::buffer(p.head), true } };
+                }
+
+                if (!seeked_)
+                {
+                    body_.file_.seek(p.first, ec);
+                    if (ec)
+                        return boost::none;
+                    remain_ = p.length;
+                    seeked_ = true;
+                }
+
+                if (remain_ > 0)
+                {
+                    auto const amount = remain_ > sizeof(buf_) ?
+                        sizeof(buf_) : static_cast<std::size_t>(remain_);
+                    auto const nread = body_.file_.read(buf_, amount, ec);
+                    if (ec)
+                        return boost::none;
+                    if (nread == 0)
+                    {
+                        ec = http::error::short_read;
+                        return boost::none;
+                    }
+                    remain_ -= nread;
+                    return { { const_buffers_type{ buf_, nread }, true } };
+                }
+
+                // Move on to the next part
+                ++index_;
+                head_sent_ = false;
+                seeked_ = false;
+            }
+
+            if (!body_.tail_.empty() && !tail_sent_)
+            {
+                tail_sent_ = true;
+                return { { net::buffer(body_.tail_), false } };
+            }
+            return boost::none;
+        }
+    };
+};
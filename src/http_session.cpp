@@ -1,36 +1,97 @@
 #include "http_session.hpp"
 #include "webrtc_session.hpp"
+#include "file_range_body.hpp"
+#include "sdp.hpp"
+#include <algorithm>
+#include <cstdio>
 #include <thread>
 
 // Rapidjson - JSON Parser library
 #include <rapidjson/document.h>
 
-http_session::http_session(
-    tcp::socket&& socket,
-    std::shared_ptr<shared_state> const& state)
-	: stream_(std::move(socket))
-    , state_(state)
+namespace {
+
+// Body size and time allowed for a request, chosen once its header is parsed
+struct route_limits
 {
+    std::uint64_t body_limit;
+    std::chrono::seconds timeout;
+
+    // Read the body into the shared pool instead of the session arena
+    bool pooled;
+};
+
+// Offers are JSON wrapped SDP, whose escaped line breaks add a few percent
+std::uint64_t constexpr offer_body_limit = 2 * max_sdp_size;
+std::uint64_t constexpr broker_body_limit = 64 * 1024;
+
+// Applied until the header names the route, so it covers every route's limit
+std::uint64_t constexpr max_body_limit = std::max(offer_body_limit, broker_body_limit);
+
+// Only the routes that take a body get more than a token allowance
+route_limits limits_for(http::verb method, beast::string_view target)
+{
+    if (method == http::verb::post)
+    {
+        auto const path = target_path(target);
+        if (path == "/offer")
+            return { offer_body_limit, std::chrono::seconds(30), true };
+        if (path == "/broker/send")
+            return { broker_body_limit, std::chrono::seconds(15), true };
+    }
+    return { 1024, std::chrono::seconds(10), false };
 }
 
+#if defined(SERVER_USE_TLS)
+// Whether a session stream needs a TLS handshake and shutdown
+template <class Stream>
+struct is_tls_stream : std::false_type {};
+
+template <class NextLayer>
+struct is_tls_stream<beast::ssl_stream<NextLayer>> : std::true_type {};
+#endif
+
+}
+
+template <class Stream>
 template<class Body, class Allocator>
-void http_session::handle_request(http::request<Body, http::basic_fields<Allocator>>&& req)
+void basic_http_session<Stream>::handle_request(http::request<Body, http::basic_fields<Allocator>>&& req)
 {
     if (req.method() == http::verb::post)
     {
-        if (req.target() == "/offer")
+        if (req.target() == "/offer" && !state_->is_broker_only())
         {
             // Parse JSON payload for sdp offer message
             rapidjson::Document message;
-            message.Parse(req.body().c_str());
-            std::string offer_payload_ = message["sdp"].GetString();
-            offer_payload_.pop_back();
+            message.Parse(req.body().data(), req.body().size());
+            if (message.HasParseError() || !message.IsObject() ||
+                !message.HasMember("sdp") || !message["sdp"].IsString())
+                return send_text(http::status::bad_request, "text/plain", "expected {\"sdp\": \"...\"}");
+            std::string offer_payload_(message["sdp"].GetString(), message["sdp"].GetStringLength());
+            if (!offer_payload_.empty())
+                offer_payload_.pop_back();
+
+            // Reject malformed or oversized offers here, before any WebRTC resources are spent
+            sdp_description offer;
+            std::string error;
+            if (!parse_sdp(offer_payload_, offer, error))
+                return send_text(http::status::bad_request, "text/plain", "invalid offer: " + error);
 
             // Create WebRTC session in shared_state
             state_->create_session(state_);
 
-            // Create Peer Connection in shared_state
-            state_->create_connection(offer_payload_);
+            // Create Peer Connection in shared_state, if the memory budget has room for it
+            if (!state_->create_connection(offer_payload_))
+            {
+                auto res = memory_.make_response<arena_string_body>(http::status::service_unavailable, req.version());
+                res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+                res.set(http::field::content_type, "text/plain");
+                res.set(http::field::retry_after, "5");
+                res.keep_alive(req.keep_alive());
+                res.body() = "memory budget exhausted";
+                res.prepare_payload();
+                return write(std::move(res));
+            }
 
             // Wait until corresponding connection's answer is created
             while (true)
@@ -43,54 +104,60 @@ void http_session::handle_request(http::request<Body, http::basic_fields<Allocat
             // Send answer JSON payload to remote peer
             return send_payload(state_->get_answer_payload());
         }
+
+        // Relay signaling between browsers
+        if (target_path(req.target()).substr(0, 8) == "/broker/")
+            return handle_broker(req.target(), beast::string_view(req.body().data(), req.body().size()));
+
+        return send_text(http::status::not_found, "text/plain", "unknown target");
     }
     // Handle other HTTP requests
     else
     {
         // Returns a bad request response
         auto const bad_request =
-            [&req](beast::string_view why)
+            [this, &req](beast::string_view why)
         {
-            http::response<http::string_body> res{ http::status::bad_request, req.version() };
+            auto res = memory_.make_response<arena_string_body>(http::status::bad_request, req.version());
             res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
             res.set(http::field::content_type, "text/html");
             res.keep_alive(req.keep_alive());
-            res.body() = std::string(why);
+            res.body().assign(why.data(), why.size());
             res.prepare_payload();
             return res;
         };
 
         // Returns a not found response
         auto const not_found =
-            [&req](beast::string_view target)
+            [this, &req](beast::string_view target)
         {
-            http::response<http::string_body> res{ http::status::not_found, req.version() };
+            auto res = memory_.make_response<arena_string_body>(http::status::not_found, req.version());
             res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
             res.set(http::field::content_type, "text/html");
             res.keep_alive(req.keep_alive());
-            res.body() = "The resource '" + std::string(target) + "' was not found.";
+            res.body().append("The resource '").append(target.data(), target.size()).append("' was not found.");
             res.prepare_payload();
             return res;
         };
 
         // Returns a server error response
         auto const server_error =
-            [&req](beast::string_view what)
+            [this, &req](beast::string_view what)
         {
-            http::response<http::string_body> res{ http::status::internal_server_error, req.version() };
+            auto res = memory_.make_response<arena_string_body>(http::status::internal_server_error, req.version());
             res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
             res.set(http::field::content_type, "text/html");
             res.keep_alive(req.keep_alive());
-            res.body() = "An error occurred: '" + std::string(what) + "'";
+            res.body().append("An error occurred: '").append(what.data(), what.size()).append("'");
             res.prepare_payload();
             return res;
         };
 
         //Returns a redirect response
         auto const redirect =
-            [&req](beast::string_view where)
+            [this, &req](beast::string_view where)
         {
-            http::response<http::string_body> res{ http::status::moved_permanently, req.version() };
+            auto res = memory_.make_response<arena_string_body>(http::status::moved_permanently, req.version());
             res.set(http::field::location, where);
             res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
             res.set(http::field::content_type, "text/html");
@@ -104,6 +171,57 @@ void http_session::handle_request(http::request<Body, http::basic_fields<Allocat
             req.method() != http::verb::head)
             return write(bad_request("Unknown HTTP-method"));
 
+        // Report whether the WebRTC engine has finished warming up
+        if (req.target() == "/ready")
+        {
+            auto const ready = state_->is_ready();
+            auto res = memory_.make_response<arena_string_body>(
+                ready ? http::status::ok : http::status::service_unavailable, req.version());
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "text/plain");
+            res.set(http::field::cache_control, "no-store");
+            res.keep_alive(req.keep_alive());
+            res.body() = ready ? "ready" : "warming up";
+            res.prepare_payload();
+            return write(std::move(res));
+        }
+
+        // Report peer connection stats, server-wide or for ?peer=<uuid>
+        if (target_path(req.target()) == "/stats")
+        {
+            auto const peer = query_param(req.target(), "peer");
+            auto const payload = state_->stats_payload(std::string(peer));
+            if (payload.empty())
+                return write(not_found(req.target()));
+
+            auto res = memory_.make_response<arena_string_body>(http::status::ok, req.version());
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.set(http::field::cache_control, "no-store");
+            res.keep_alive(req.keep_alive());
+            res.body().assign(payload.data(), payload.size());
+            res.prepare_payload();
+            return write(std::move(res));
+        }
+
+        // Relay signaling between browsers
+        if (target_path(req.target()).substr(0, 8) == "/broker/")
+            return handle_broker(req.target(), {});
+
+        // Report memory use by subsystem and by peer connection
+        if (req.target() == "/memory")
+        {
+            auto const payload = state_->memory_payload();
+            auto res = memory_.make_response<arena_string_body>(http::status::ok, req.version());
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_type, "application/json");
+            res.set(http::field::cache_control, "no-store");
+            res.keep_alive(req.keep_alive());
+            res.body().assign(payload.data(), payload.size());
+            res.prepare_payload();
+            return write(std::move(res));
+        }
+
         // Redirect to index.html
         if (req.target().empty() ||
             req.target().back() == '/' ||
@@ -111,7 +229,7 @@ void http_session::handle_request(http::request<Body, http::basic_fields<Allocat
             return write(redirect("/index.html"));
 
         // Build the path to the requested file
-        std::string path = path_cat(state_->doc_root(), req.target());
+        auto const path = path_cat(state_->doc_root(), req.target(), memory_.allocator());
 
         // Attempt to open the file
         beast::error_code ec;
@@ -129,104 +247,423 @@ void http_session::handle_request(http::request<Body, http::basic_fields<Allocat
         // Cache the size since we need it after the move
         auto const size = body.size();
 
+        // Validator for If-Range, also handed out with every full response
+        char etag_buf[48];
+        auto const etag = file_etag(path.c_str(), size, etag_buf, sizeof(etag_buf));
+
         // Respond to HEAD request
         if (req.method() == http::verb::head)
         {
-            http::response<http::empty_body> res{ http::status::ok, req.version() };
+            auto res = memory_.make_response<http::empty_body>(http::status::ok, req.version());
             res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
             res.set(http::field::content_type, mime_type(path));
+            res.set(http::field::accept_ranges, "bytes");
+            res.set(http::field::etag, etag);
             res.content_length(size);
             res.keep_alive(req.keep_alive());
             return write(std::move(res));
         }
 
+        // Serve the requested byte ranges, unless If-Range
+        // says the client's copy of the file is out of date
+        auto const range = req[http::field::range];
+        auto const if_range = req[http::field::if_range];
+        std::vector<std::pair<std::uint64_t, std::uint64_t>> ranges;
+        auto const result = range.empty() || (!if_range.empty() && if_range != etag) ?
+            range_result::none : parse_range(range, size, ranges);
+
+        // Respond to an unsatisfiable range request
+        if (result == range_result::unsatisfiable)
+        {
+            char content_range[48];
+            std::snprintf(content_range, sizeof(content_range), "bytes */%llu",
+                static_cast<unsigned long long>(size));
+            auto res = memory_.make_response<http::empty_body>(http::status::range_not_satisfiable, req.version());
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::content_range, content_range);
+            res.content_length(0);
+            res.keep_alive(req.keep_alive());
+            return write(std::move(res));
+        }
+
+        // Respond to a range request
+        if (result == range_result::satisfiable)
+        {
+            auto res = memory_.make_response<file_range_body>(http::status::partial_content, req.version());
+            res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+            res.set(http::field::accept_ranges, "bytes");
+            res.set(http::field::etag, etag);
+            res.body().reset(std::move(body.file()));
+
+            auto const content_range = [size](std::uint64_t first, std::uint64_t length)
+            {
+                char buf[80];
+                std::snprintf(buf, sizeof(buf), "bytes %llu-%llu/%llu",
+                    static_cast<unsigned long long>(first),
+                    static_cast<unsigned long long>(first + length - 1),
+                    static_cast<unsigned long long>(size));
+                return std::string(buf);
+            };
+
+            if (ranges.size() == 1)
+            {
+                // A single range is sent as the body itself
+                res.set(http::field::content_type, mime_type(path));
+                res.set(http::field::content_range, content_range(ranges[0].first, ranges[0].second));
+                res.body().add({}, ranges[0].first, ranges[0].second);
+            }
+            else
+            {
+                // Several ranges are sent as multipart/byteranges
+                beast::string_view constexpr boundary = "3d6b6a416f9b5a7c";
+                res.set(http::field::content_type,
+                    "multipart/byteranges; boundary=" + std::string(boundary));
+                auto const type = mime_type(path);
+                for (auto const& r : ranges)
+                {
+                    std::string head = "\r\n--";
+                    head.append(boundary.data(), boundary.size());
+                    head.append("\r\nContent-Type: ");
+                    head.append(type.data(), type.size());
+                    head.append("\r\nContent-Range: ");
+                    head.append(content_range(r.first, r.second));
+                    head.append("\r\n\r\n");
+                    res.body().add(std::move(head), r.first, r.second);
+                }
+                res.body().tail("\r\n--" + std::string(boundary) + "--\r\n");
+            }
+
+            res.content_length(file_range_body::size(res.body()));
+            res.keep_alive(req.keep_alive());
+            return write(std::move(res));
+        }
+
         // Respond to GET request
-        http::response<http::file_body> res{
-            std::piecewise_construct,
-            std::make_tuple(std::move(body)),
-            std::make_tuple(http::status::ok, req.version()) };
+        auto res = memory_.make_response<http::file_body>(http::status::ok, req.version());
+        res.body() = std::move(body);
         res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
         res.set(http::field::content_type, mime_type(path));
+        res.set(http::field::accept_ranges, "bytes");
+        res.set(http::field::etag, etag);
         res.content_length(size);
         res.keep_alive(req.keep_alive());
         return write(std::move(res));
     }
 }
 
-void http_session::run()
+template <class Stream>
+void basic_http_session<Stream>::run()
 {
+#if defined(SERVER_USE_TLS)
+    if constexpr (is_tls_stream<Stream>::value)
+    {
+        // Set the timeout
+        beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(10));
+
+        // Perform the TLS handshake; a returning client resumes
+        // its session from a ticket or the server cache
+        stream_.async_handshake(
+            net::ssl::stream_base::server,
+            beast::bind_front_handler(
+                &basic_http_session::on_handshake,
+                this->shared_from_this()));
+        return;
+    }
+#endif
 	do_read();
 }
 
-void http_session::do_read()
+#if defined(SERVER_USE_TLS)
+template <class Stream>
+void basic_http_session<Stream>::on_handshake(beast::error_code ec)
+{
+    if (ec)
+        return fail(ec, "handshake");
+
+    do_read();
+}
+#endif
+
+template <class Stream>
+void basic_http_session<Stream>::do_read()
 {
-    // Construct a new parser for each message
-    parser_.emplace();
+    // Construct a new parser for each message, in an arena
+    // emptied of everything the previous request left
+    auto& parser = memory_.next_request();
 
-    // Apply a reasonable limit to the allowed size
-    // of the body in bytes to prevent abuse
-    parser_->body_limit(10000);
+    // The route's limit is applied once the header is known,
+    // until then no route's limit may be exceeded
+    parser.body_limit(max_body_limit);
 
     // Set the timeout
-    stream_.expires_after(std::chrono::seconds(10));
+    beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(10));
+
+    // Read the header of a request
+    http::async_read_header(
+        stream_,
+        memory_.buffer(),
+        parser,
+        beast::bind_front_handler(
+            &basic_http_session::on_header,
+            this->shared_from_this()));
+}
 
-    // Read a request
+template <class Stream>
+void basic_http_session<Stream>::on_header(beast::error_code ec, std::size_t)
+{
+    // This means they closed the connection
+    if (ec == http::error::end_of_stream)
+        return do_close();
+
+    // A Content-Length beyond every route's limit
+    if (ec == http::error::body_limit)
+        return send_too_large();
+
+    // Handle the error, if any
+    if (ec)
+        return fail(ec, "read");
+
+    // The parser only checks Content-Length against the limit set before the header
+    auto& parser = memory_.parser();
+    auto const& req = parser.get();
+    auto const limits = limits_for(req.method(), req.target());
+    if (parser.content_length() && *parser.content_length() > limits.body_limit)
+        return send_too_large();
+    parser.body_limit(limits.body_limit);
+
+    // Large bodies are streamed into a buffer from the shared pool,
+    // so sessions don't each keep arena blocks of that size
+    if (limits.pooled)
+        memory_.use_body_pool(state_->body_pool());
+
+    // Set the timeout for the rest of the request
+    beast::get_lowest_layer(stream_).expires_after(limits.timeout);
+
+    // Read the body
     http::async_read(
         stream_,
-        buffer_,
-        parser_->get(),
+        memory_.buffer(),
+        parser,
         beast::bind_front_handler(
-            &http_session::on_read,
-            shared_from_this()));
+            &basic_http_session::on_read,
+            this->shared_from_this()));
 }
 
-void http_session::on_read(beast::error_code ec, std::size_t)
+template <class Stream>
+void basic_http_session<Stream>::on_read(beast::error_code ec, std::size_t)
 {
     // This means they closed the connection
     if (ec == http::error::end_of_stream)
         return do_close();
 
+    // A chunked body beyond the route's limit
+    if (ec == http::error::body_limit)
+        return send_too_large();
+
     // Handle the error, if any
     if (ec)
         return fail(ec, "read");
 
-    handle_request(std::move(parser_->get()));
+    handle_request(std::move(memory_.parser().get()));
 }
 
-void http_session::send_payload(std::string const& payload)
+template <class Stream>
+void basic_http_session<Stream>::send_payload(std::string const& payload)
 {
     // Send response and close this http_session
-    auto const req = parser_->get();
-    http::response<http::string_body> res{ http::status::ok, req.version() };
+    auto const& req = memory_.parser().get();
+    auto res = memory_.make_response<arena_string_body>(http::status::ok, req.version());
     res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
     res.set(http::field::content_type, "application/json");
     res.keep_alive(false);
-    res.body() = payload;
+    res.body().assign(payload.data(), payload.size());
     res.prepare_payload();
 
     return write(std::move(res));
 }
 
+template <class Stream>
+void basic_http_session<Stream>::send_too_large()
+{
+    // The rest of the body is still on the wire, so close after responding
+    auto res = memory_.make_response<arena_string_body>(http::status::payload_too_large, memory_.parser().get().version());
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, "text/plain");
+    res.keep_alive(false);
+    res.body() = "request body too large";
+    res.prepare_payload();
+
+    return write(std::move(res));
+}
+
+template <class Stream>
+void basic_http_session<Stream>::send_text(
+    http::status status,
+    beast::string_view content_type,
+    beast::string_view body)
+{
+    auto const& req = memory_.parser().get();
+    auto res = memory_.make_response<arena_string_body>(status, req.version());
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::content_type, content_type);
+    res.set(http::field::cache_control, "no-store");
+    res.keep_alive(req.keep_alive());
+    res.body().assign(body.data(), body.size());
+    res.prepare_payload();
+
+    return write(std::move(res));
+}
+
+template <class Stream>
+void basic_http_session<Stream>::handle_broker(beast::string_view target, beast::string_view body)
+{
+    // Every call names a room; peer, from and to name peers of that room
+    auto const param = [target](beast::string_view name)
+    {
+        auto const value = query_param(target, name);
+        return std::string(value.data(), value.size());
+    };
+    auto const room = param("room");
+    if (room.empty())
+        return send_text(http::status::bad_request, "text/plain", "missing room");
+
+    auto& broker = state_->broker();
+    auto const path = target_path(target);
+    auto const method = memory_.parser().get().method();
+
+    // GET /broker/peers?room=
+    if (path == "/broker/peers" && method == http::verb::get)
+        return send_text(http::status::ok, "application/json", broker.peers(room));
+
+    // GET /broker/poll?room=&peer=
+    if (path == "/broker/poll" && method == http::verb::get)
+        return long_poll(room, param("peer"));
+
+    // POST /broker/send?room=&from=&to= with the message as the body
+    if (path == "/broker/send" && method == http::verb::post)
+    {
+        switch (broker.send(room, param("from"), param("to"), std::string(body.data(), body.size())))
+        {
+        case signaling_broker::result::ok:
+            return send_text(http::status::no_content, "text/plain", {});
+        case signaling_broker::result::unknown_peer:
+            return send_text(http::status::not_found, "text/plain", "unknown peer");
+        case signaling_broker::result::mailbox_full:
+            return send_text(http::status::too_many_requests, "text/plain", "mailbox full");
+        case signaling_broker::result::over_budget:
+            return send_text(http::status::service_unavailable, "text/plain", "memory budget exhausted");
+        default:
+            break;
+        }
+    }
+
+    auto const peer = param("peer");
+    if (peer.empty())
+        return send_text(http::status::bad_request, "text/plain", "missing peer");
+
+    // POST /broker/join?room=&peer=
+    if (path == "/broker/join" && method == http::verb::post)
+    {
+        switch (broker.join(room, peer))
+        {
+        case signaling_broker::result::room_full:
+            return send_text(http::status::too_many_requests, "text/plain", "room full");
+        case signaling_broker::result::too_many_peers:
+            return send_text(http::status::service_unavailable, "text/plain", "too many peers");
+        case signaling_broker::result::over_budget:
+            return send_text(http::status::service_unavailable, "text/plain", "memory budget exhausted");
+        default:
+            return send_text(http::status::ok, "application/json", broker.peers(room));
+        }
+    }
+
+    // POST /broker/leave?room=&peer=
+    if (path == "/broker/leave" && method == http::verb::post)
+    {
+        broker.leave(room, peer);
+        return send_text(http::status::no_content, "text/plain", {});
+    }
+
+    return send_text(http::status::not_found, "text/plain", "unknown broker call");
+}
+
+template <class Stream>
+void basic_http_session<Stream>::long_poll(std::string const& room, std::string const& peer)
+{
+    // Messages may arrive on another session's thread, the response is written on ours
+    signaling_broker::result r;
+    auto const token = state_->broker().poll(room, peer,
+        [self = this->shared_from_this()](std::string messages)
+        {
+            net::post(
+                self->stream_.get_executor(),
+                [self, messages = std::move(messages)]
+                {
+                    if (self->poll_timer_)
+                        self->poll_timer_->cancel();
+                    self->send_text(http::status::ok, "application/json", messages);
+                });
+        },
+        r);
+    if (r == signaling_broker::result::unknown_peer)
+        return send_text(http::status::not_found, "text/plain", "unknown peer");
+
+    // Answered already
+    if (!token)
+        return;
+
+    // Answer with no messages if none arrive in time
+    if (!poll_timer_)
+        poll_timer_.emplace(stream_.get_executor());
+    poll_timer_->expires_after(std::chrono::seconds(25));
+    poll_timer_->async_wait(
+        [self = this->shared_from_this(), room, peer, token](beast::error_code ec)
+        {
+            if (ec)
+                return;
+            // A message that won the race writes the response instead
+            if (self->state_->broker().cancel(room, peer, token))
+                self->send_text(http::status::no_content, "text/plain", {});
+        });
+}
+
+template <class Stream>
 template <class BodyType>
-void http_session::write(http::response<BodyType>&& res)
+void basic_http_session<Stream>::write(http::response<BodyType, arena_fields>&& res)
 {
     // The lifetime of the message has to extend
     // for the duration of the async operation so
-    // we use a shared_ptr to manage it.
-    using response_type = typename std::decay<decltype(res)>::type;
-    auto sp = boost::make_shared<response_type>(std::forward<decltype(res)>(res));
+    // the session memory holds it in the arena
+    auto& out = memory_.hold(std::move(res));
 
     // Write the response
-    auto self = shared_from_this();
-    http::async_write(stream_, *sp,
-        [self, sp](beast::error_code ec, std::size_t bytes)
+    do_write(out);
+}
+
+template <class Stream>
+template <class BodyType>
+void basic_http_session<Stream>::do_write(outgoing<BodyType>& out)
+{
+    // Each chunk gets a fresh deadline, so a large body only
+    // times out when the client stops reading, not when it is slow
+    beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(10));
+
+    // Send the next chunk of the response
+    http::async_write_some(stream_, out.sr,
+        [self = this->shared_from_this(), &out](beast::error_code ec, std::size_t bytes)
         {
-            self->on_write(ec, bytes, sp->need_eof());
+            if (!ec && !out.sr.is_done())
+                return self->do_write(out);
+            self->on_write(out.msg.need_eof(), ec, bytes);
         });
 }
 
-void http_session::on_write(beast::error_code ec, std::size_t, bool close)
+template <class Stream>
+void basic_http_session<Stream>::on_write(bool close, beast::error_code ec, std::size_t)
 {
+    // We're done with the response so release it
+    memory_.release_response();
+
     // Handle the error, if any
     if (ec)
         return fail(ec, "write");
@@ -238,9 +675,39 @@ void http_session::on_write(beast::error_code ec, std::size_t, bool close)
     do_read();
 }
 
-void http_session::do_close()
+template <class Stream>
+void basic_http_session<Stream>::do_close()
 {
+#if defined(SERVER_USE_TLS)
+    if constexpr (is_tls_stream<Stream>::value)
+    {
+        // Set the timeout
+        beast::get_lowest_layer(stream_).expires_after(std::chrono::seconds(10));
+
+        // Perform the TLS shutdown
+        stream_.async_shutdown(
+            beast::bind_front_handler(
+                &basic_http_session::on_shutdown,
+                this->shared_from_this()));
+        return;
+    }
+#endif
     // Send a TCP shutdown
     beast::error_code ec;
-    stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
-}
\ No newline at end of file
+    beast::get_lowest_layer(stream_).socket().shutdown(tcp::socket::shutdown_send, ec);
+}
+
+#if defined(SERVER_USE_TLS)
+template <class Stream>
+void basic_http_session<Stream>::on_shutdown(beast::error_code ec)
+{
+    // Clients often close without a close_notify
+    if (ec && ec != net::ssl::error::stream_truncated)
+        return fail(ec, "shutdown");
+}
+#endif
+
+template class basic_http_session<beast::tcp_stream>;
+#if defined(SERVER_USE_TLS)
+template class basic_http_session<beast::ssl_stream<beast::tcp_stream>>;
+#endif
\ No newline at end of file
@@ -1,36 +1,76 @@
 #pragma once
 
 #include "beast.hpp"
+#include "session_memory.hpp"
 #include "shared_state.hpp"
 #include <boost/beast/version.hpp>
+#include <boost/asio/steady_timer.hpp>
+#if defined(SERVER_USE_TLS)
+#include <boost/beast/ssl.hpp>
+#endif
 
-// Handles an HTTP server connection
-class http_session : public std::enable_shared_from_this<http_session>
+// Handles an HTTP server connection over a plain or TLS stream
+template <class Stream>
+class basic_http_session : public std::enable_shared_from_this<basic_http_session<Stream>>
 {
-    beast::tcp_stream stream_;
-    beast::flat_buffer buffer_;
+    Stream stream_;
     std::shared_ptr<shared_state> state_;
-    // The parser is stored in an optional container so we can
-    // construct it from scratch it at the beginning of each new message.
-    boost::optional<http::request_parser<http::string_body>> parser_;
+
+    // Read buffer, request parser and response of the session
+    session_memory memory_;
+
+    // Ends a broker long-poll without messages, created by the first poll
+    boost::optional<net::steady_timer> poll_timer_;
 
 public:
-    http_session(
+    // Extra arguments are passed on to the stream, e.g. the ssl::context
+    template <class... Args>
+    basic_http_session(
         tcp::socket&& socket,
-        std::shared_ptr<shared_state> const& state);
-    ~http_session() {}
+        std::shared_ptr<shared_state> const& state,
+        Args&... args)
+        : stream_(std::move(socket), args...)
+        , state_(state)
+        , memory_(state->memory())
+    {
+        state_->session_opened();
+        state_->memory().charge(memory_subsystem::http_sessions, sizeof(*this));
+    }
+    ~basic_http_session()
+    {
+        state_->memory().charge(memory_subsystem::http_sessions, -static_cast<std::int64_t>(sizeof(*this)));
+        state_->session_closed();
+    }
     
     void run();
     
 private:
+#if defined(SERVER_USE_TLS)
+    void on_handshake(beast::error_code ec);
+#endif
     void do_read();
+    void on_header(beast::error_code ec, std::size_t);
     void on_read(beast::error_code ec, std::size_t);
+    void send_too_large();
     void send_payload(std::string const& payload);
+    void send_text(http::status status, beast::string_view content_type, beast::string_view body);
+    void handle_broker(beast::string_view target, beast::string_view body);
+    void long_poll(std::string const& room, std::string const& peer);
     template <class BodyType>
-    void write(http::response<BodyType>&& res);
-    void on_write(beast::error_code ec, std::size_t, bool close);
+    void write(http::response<BodyType, arena_fields>&& res);
+    template <class BodyType>
+    void do_write(outgoing<BodyType>& out);
+    void on_write(bool close, beast::error_code ec, std::size_t);
     void do_close();
+#if defined(SERVER_USE_TLS)
+    void on_shutdown(beast::error_code ec);
+#endif
 
     template<class Body, class Allocator>
     void handle_request(http::request<Body, http::basic_fields<Allocator>>&& req);
-};
\ No newline at end of file
+};
+
+using http_session = basic_http_session<beast::tcp_stream>;
+#if defined(SERVER_USE_TLS)
+using https_session = basic_http_session<beast::ssl_stream<beast::tcp_stream>>;
+#endif
@@ -6,7 +6,7 @@ listener::listener(
     tcp::endpoint endpoint,
     std::shared_ptr<shared_state> const& state)
     : ioc_(ioc)
-    , acceptor_(ioc)
+    , acceptor_(net::make_strand(ioc))
     , state_(state)
 {
     beast::error_code ec;
@@ -24,6 +24,7 @@ listener::listener(
     if (ec)
     {
         fail(ec, "set_option");
+        acceptor_.close(ec);
         return;
     }
 
@@ -32,6 +33,7 @@ listener::listener(
     if (ec)
     {
         fail(ec, "bind");
+        acceptor_.close(ec);
         return;
     }
 
@@ -41,6 +43,27 @@ listener::listener(
     if (ec)
     {
         fail(ec, "listen");
+        acceptor_.close(ec);
+        return;
+    }
+}
+
+listener::listener(
+    net::io_context& ioc,
+    tcp protocol,
+    tcp::acceptor::native_handle_type handle,
+    std::shared_ptr<shared_state> const& state)
+    : ioc_(ioc)
+    , acceptor_(net::make_strand(ioc))
+    , state_(state)
+{
+    beast::error_code ec;
+
+    // The socket is already bound and listening
+    acceptor_.assign(protocol, handle, ec);
+    if (ec)
+    {
+        fail(ec, "assign");
         return;
     }
 }
@@ -51,6 +74,18 @@ void listener::run()
     do_accept();
 }
 
+void listener::stop()
+{
+    // Close on the acceptor's strand, so it can't race a pending accept
+    net::dispatch(
+        acceptor_.get_executor(),
+        [self = shared_from_this()]
+        {
+            beast::error_code ec;
+            self->acceptor_.close(ec);
+        });
+}
+
 void listener::do_accept()
 {
     // The new connection gets its own strand
@@ -63,8 +98,23 @@ void listener::do_accept()
 
 void listener::on_accept(beast::error_code ec, tcp::socket socket)
 {
+    // Stopped while no connection was pending
+    if (ec == net::error::operation_aborted)
+        return;
+
+    // A connection accepted just before stop() is still served
     if (ec)
         fail(ec, "accept");
+#if defined(SERVER_USE_TLS)
+    else if (ssl_ctx_)
+    {
+        // Create the TLS session and run it
+        std::make_shared<https_session>(
+            std::move(socket),
+            state_,
+            *ssl_ctx_)->run();
+    }
+#endif
     else
     {
         // Create the session and run it
@@ -73,6 +123,7 @@ void listener::on_accept(beast::error_code ec, tcp::socket socket)
             state_)->run();
     }
 
-    // Accept another connection
-    do_accept();
+    // Accept another connection, unless stopped
+    if (acceptor_.is_open())
+        do_accept();
 }
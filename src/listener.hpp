@@ -2,6 +2,9 @@
 
 #include "beast.hpp"
 #include <memory>
+#if defined(SERVER_USE_TLS)
+#include <boost/asio/ssl/context.hpp>
+#endif
 
 // Forward declaration
 class shared_state;
@@ -12,6 +15,10 @@ class listener : public std::enable_shared_from_this<listener>
     net::io_context& ioc_;
     tcp::acceptor acceptor_;
     std::shared_ptr<shared_state> state_;
+#if defined(SERVER_USE_TLS)
+    // Sessions speak HTTPS when this is set
+    std::shared_ptr<net::ssl::context> ssl_ctx_;
+#endif
 
 public:
     listener(
@@ -19,9 +26,30 @@ public:
         tcp::endpoint endpoint,
         std::shared_ptr<shared_state> const& state);
 
+    // Adopt a listening socket handed over by another process
+    listener(
+        net::io_context& ioc,
+        tcp protocol,
+        tcp::acceptor::native_handle_type handle,
+        std::shared_ptr<shared_state> const& state);
+
+#if defined(SERVER_USE_TLS)
+    // Serve HTTPS with this context, must be called before run()
+    void set_ssl_context(std::shared_ptr<net::ssl::context> const& ssl_ctx) { ssl_ctx_ = ssl_ctx; }
+#endif
+
+    // Whether the listening socket was bound or adopted
+    bool is_open() const { return acceptor_.is_open(); }
+
+    // The listening socket, to hand over to another process
+    tcp::acceptor::native_handle_type native_handle() { return acceptor_.native_handle(); }
+
     // Start accepting incoming connections
     void run();
 
+    // Stop accepting; the listening socket stays open in other processes holding it
+    void stop();
+
 private:
     void do_accept();
     void on_accept(beast::error_code ec, tcp::socket socket);
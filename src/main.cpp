@@ -1,28 +1,150 @@
 #include "beast.hpp"
 #include "listener.hpp"
 #include "shared_state.hpp"
+#include "socket_handoff.hpp"
+#include "startup_phase.hpp"
+#include "tls_context.hpp"
 #include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <chrono>
 #include <memory>
 #include <vector>
 #include <filesystem>
 
 #define THREADS 4
 
+// Memory the server may use; new peer connections are refused beyond it
+#define MEMORY_BUDGET_MB 1024
+
+#if !defined(_WIN32)
+// Longest time a replaced server keeps serving its existing connections
+#define DRAIN_SECONDS 30
+
+// Stop the io_context once the sessions and peer connections are gone, or at the deadline
+void drain(
+    net::steady_timer& timer,
+    net::io_context& ioc,
+    std::shared_ptr<shared_state> const& state,
+    std::chrono::steady_clock::time_point deadline)
+{
+    if ((state->session_count() == 0 && state->connection_count() == 0) ||
+        std::chrono::steady_clock::now() >= deadline)
+    {
+        ioc.stop();
+        return;
+    }
+
+    timer.expires_after(std::chrono::milliseconds(500));
+    timer.async_wait(
+        [&timer, &ioc, state, deadline](beast::error_code ec)
+        {
+            if (!ec)
+                drain(timer, ioc, state, deadline);
+        });
+}
+#endif
+
 int main(int argc, char* argv[])
 {
+    // Relay signaling between browsers only, without the WebRTC engine: server --broker
+    bool const broker_only = argc > 1 && std::string(argv[1]) == "--broker";
+    if (broker_only)
+    {
+        --argc;
+        ++argv;
+    }
+
     // Arguments
     auto const address = net::ip::make_address("0.0.0.0");
     auto const port = static_cast<unsigned short>(8080);
     auto const doc_root = std::filesystem::absolute("../../client").string();
+#if !defined(_WIN32)
+    // The handoff socket lives in a directory only this user can enter
+    beast::error_code handoff_ec;
+    auto const handoff_path = handoff_socket_path("local-webrtc-signaling", handoff_ec);
+    if (handoff_ec)
+        fail(handoff_ec, "handoff directory");
+#endif
 
     // The io_context is required for all I/O
     net::io_context ioc{ THREADS };
 
-    // Create and launch a listening port
-    std::make_shared<listener>(
-        ioc,
-        tcp::endpoint{ address, port },
-        std::make_shared<shared_state>(doc_root))->run();
+    // Initialize the WebRTC engine before taking any traffic,
+    // so the first offer doesn't pay for it
+    auto const state = std::make_shared<shared_state>(
+        doc_root,
+        static_cast<std::uint64_t>(MEMORY_BUDGET_MB) * 1024 * 1024);
+    if (broker_only)
+        state->start_broker_only();
+    else
+        startup_phase("warm up", [&state]
+            {
+                state->warm_up(state, warm_up_options{});
+            });
+
+    // Create and launch a listening port, taking it over
+    // from a running server if there is one
+    std::shared_ptr<listener> server;
+    startup_phase("listen", [&]
+        {
+#if !defined(_WIN32)
+            beast::error_code ec;
+            auto const inherited = handoff_path.empty() ?
+                std::vector<native_listener>{} : take_listeners(handoff_path, ec);
+            if (ec)
+                fail(ec, "handoff");
+            if (!inherited.empty())
+            {
+                server = std::make_shared<listener>(
+                    ioc,
+                    tcp::endpoint{ address, port }.protocol(),
+                    inherited.front(),
+                    state);
+                return;
+            }
+#endif
+            server = std::make_shared<listener>(
+                ioc,
+                tcp::endpoint{ address, port },
+                state);
+        });
+
+    // Neither adopted nor bound: serving nothing, and nothing to hand over
+    if (!server->is_open())
+        return EXIT_FAILURE;
+#if defined(SERVER_USE_TLS)
+    // Serve HTTPS when given a certificate chain and key: server <cert.pem> <key.pem>
+    if (argc == 3)
+    {
+        beast::error_code ec;
+        auto const ssl_ctx = make_tls_context(argv[1], argv[2], ec);
+        if (ec)
+        {
+            fail(ec, "tls");
+            return EXIT_FAILURE;
+        }
+        server->set_ssl_context(ssl_ctx);
+    }
+#endif
+    server->run();
+
+#if !defined(_WIN32)
+    // Hand the listening socket to the next server process when it starts,
+    // then drain the sessions and peer connections of this one
+    net::steady_timer drain_timer(ioc);
+    if (!handoff_path.empty())
+        std::make_shared<handoff_server>(
+            ioc,
+            handoff_path,
+            std::vector<native_listener>{ server->native_handle() },
+            [&]
+            {
+                std::cout << "Handed off the listening socket, draining" << std::endl;
+                server->stop();
+                drain(drain_timer, ioc, state,
+                    std::chrono::steady_clock::now() + std::chrono::seconds(DRAIN_SECONDS));
+            })->run();
+#endif
 
     // Capture SIGINT and SIGTERM to perform a clean shutdown
     net::signal_set signals(ioc, SIGINT, SIGTERM);
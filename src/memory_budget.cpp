@@ -0,0 +1,49 @@
+#include "memory_budget.hpp"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+std::string memory_budget::to_json(std::vector<peer_footprint> const& peers) const
+{
+    std::uint64_t peer_connections = 0, data_channels = 0;
+    for (auto const& p : peers)
+    {
+        peer_connections += p.peer_connection;
+        data_channels += p.data_channels;
+    }
+
+    rapidjson::StringBuffer strbuf;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
+    writer.StartObject();
+    writer.Key("limit");
+    writer.Uint64(limit_);
+    writer.Key("total");
+    writer.Uint64(total(peers));
+    writer.Key("http_sessions");
+    writer.Uint64(used(memory_subsystem::http_sessions));
+    writer.Key("http_buffers");
+    writer.Uint64(used(memory_subsystem::http_buffers));
+    writer.Key("peer_connections");
+    writer.Uint64(peer_connections);
+    writer.Key("data_channels");
+    writer.Uint64(data_channels);
+    writer.Key("broker");
+    writer.Uint64(used(memory_subsystem::broker));
+
+    writer.Key("peers");
+    writer.StartArray();
+    for (auto const& p : peers)
+    {
+        writer.StartObject();
+        writer.Key("uuid");
+        writer.String(p.uuid.c_str());
+        writer.Key("peer_connection");
+        writer.Uint64(p.peer_connection);
+        writer.Key("data_channels");
+        writer.Uint64(p.data_channels);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+    return strbuf.GetString();
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+// Parts of the server whose memory is accounted
+enum class memory_subsystem
+{
+    // The http_session objects themselves
+    http_sessions,
+    // Read buffers, parsers and responses of the sessions
+    http_buffers,
+    // Peer connections, including an estimate of libwebrtc's share
+    peer_connections,
+    // Data channels and the messages queued on them
+    data_channels,
+    // Broker mailboxes and the messages queued in them
+    broker,
+    count
+};
+
+// What libwebrtc is assumed to hold for one peer connection with data channels:
+// SCTP association and its send and receive buffers, DTLS and ICE transports.
+// It can't be measured from outside, so admission control works with this estimate.
+std::size_t constexpr peer_connection_estimate = 512 * 1024;
+
+// Memory held for one peer connection
+struct peer_footprint
+{
+    std::string uuid;
+    std::uint64_t peer_connection = 0;
+    std::uint64_t data_channels = 0;
+};
+
+// Server-wide memory accounting with a global limit.
+// HTTP sessions are charged as they allocate. Peer connections change
+// inside libwebrtc, so their footprints are read from the counters each
+// connection keeps on the signaling thread, and passed in.
+class memory_budget
+{
+    std::uint64_t const limit_;
+    std::array<std::atomic<std::int64_t>, static_cast<std::size_t>(memory_subsystem::count)> used_;
+
+public:
+    explicit memory_budget(std::uint64_t limit)
+        : limit_(limit)
+    {
+        for (auto& used : used_)
+            used = 0;
+    }
+
+    std::uint64_t limit() const { return limit_; }
+
+    // Add bytes to a subsystem, or release them when negative
+    void charge(memory_subsystem subsystem, std::int64_t bytes)
+    {
+        used_[static_cast<std::size_t>(subsystem)] += bytes;
+    }
+
+    // Bytes charged to a subsystem
+    std::uint64_t used(memory_subsystem subsystem) const
+    {
+        auto const bytes = used_[static_cast<std::size_t>(subsystem)].load();
+        return bytes > 0 ? static_cast<std::uint64_t>(bytes) : 0;
+    }
+
+    // Charge bytes to a subsystem unless the charged memory would exceed the limit.
+    // Concurrent charges may overshoot the limit by what they add together.
+    bool try_charge(memory_subsystem subsystem, std::uint64_t bytes)
+    {
+        if (charged() + bytes > limit_)
+            return false;
+        charge(subsystem, static_cast<std::int64_t>(bytes));
+        return true;
+    }
+
+    // Whether another bytes fit next to the charged memory and the given peers
+    bool admits(std::uint64_t bytes, std::vector<peer_footprint> const& peers) const
+    {
+        return total(peers) + bytes <= limit_;
+    }
+
+    // Memory charged as it is allocated, without the peer connections
+    std::uint64_t charged() const
+    {
+        return used(memory_subsystem::http_sessions) +
+            used(memory_subsystem::http_buffers) +
+            used(memory_subsystem::broker);
+    }
+
+    // Charged memory plus the given peers
+    std::uint64_t total(std::vector<peer_footprint> const& peers) const
+    {
+        std::uint64_t total = charged();
+        for (auto const& p : peers)
+            total += p.peer_connection + p.data_channels;
+        return total;
+    }
+
+    // Use by subsystem and by peer connection, as JSON
+    std::string to_json(std::vector<peer_footprint> const& peers) const;
+};
+
+// Forwards to an upstream resource and charges the outstanding bytes to a subsystem.
+// The counters are atomic, so it is as thread safe as its upstream.
+class counting_resource : public std::pmr::memory_resource
+{
+    memory_budget& budget_;
+    memory_subsystem const subsystem_;
+    std::pmr::memory_resource* const upstream_;
+    std::atomic<std::size_t> outstanding_{ 0 };
+
+public:
+    counting_resource(
+        memory_budget& budget,
+        memory_subsystem subsystem,
+        std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+        : budget_(budget)
+        , subsystem_(subsystem)
+        , upstream_(upstream)
+    {
+    }
+
+    // Bytes allocated and not yet deallocated
+    std::size_t outstanding() const { return outstanding_; }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        auto const p = upstream_->allocate(bytes, alignment);
+        outstanding_ += bytes;
+        budget_.charge(subsystem_, static_cast<std::int64_t>(bytes));
+        return p;
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        upstream_->deallocate(p, bytes, alignment);
+        outstanding_ -= bytes;
+        budget_.charge(subsystem_, -static_cast<std::int64_t>(bytes));
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
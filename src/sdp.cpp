@@ -0,0 +1,209 @@
+#include "sdp.hpp"
+
+namespace {
+
+// Split the next line off text, accepting CRLF and LF line endings
+std::string_view next_line(std::string_view& text)
+{
+    auto const end = text.find('\n');
+    auto line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    if (!line.empty() && line.back() == '\r')
+        line.remove_suffix(1);
+    return line;
+}
+
+// Split the next space separated token off text
+std::string_view next_token(std::string_view& text)
+{
+    auto const end = text.find(' ');
+    auto const token = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    return token;
+}
+
+// The value of an "a=name:value" attribute, if line is that attribute
+bool attribute(std::string_view line, std::string_view name, std::string_view& value)
+{
+    if (line.size() < name.size() + 3 ||
+        line.compare(2, name.size(), name) != 0 ||
+        line[2 + name.size()] != ':')
+        return false;
+    value = line.substr(3 + name.size());
+    return true;
+}
+
+// Describe why a description is rejected
+bool reject(std::string& error, std::string message)
+{
+    error = std::move(message);
+    return false;
+}
+
+bool is_number(std::string_view s)
+{
+    if (s.empty() || s.size() > 5)
+        return false;
+    for (auto c : s)
+        if (c < '0' || c > '9')
+            return false;
+    return true;
+}
+
+}
+
+bool parse_sdp(std::string_view text, sdp_description& out, std::string& error)
+{
+    out = sdp_description{};
+
+    if (text.empty())
+        return reject(error, "empty description");
+    if (text.size() > max_sdp_size)
+        return reject(error, "description too large");
+
+    bool origin = false, name = false;
+    std::size_t number = 0;
+    while (!text.empty())
+    {
+        auto const line = next_line(text);
+        ++number;
+
+        // Tolerate a trailing empty line only
+        if (line.empty())
+        {
+            if (text.empty())
+                break;
+            return reject(error, "empty line " + std::to_string(number));
+        }
+        if (line.size() > max_sdp_line)
+            return reject(error, "line " + std::to_string(number) + " too long");
+        if (line.size() < 2 || line[0] < 'a' || line[0] > 'z' || line[1] != '=')
+            return reject(error, "malformed line " + std::to_string(number));
+
+        if (number == 1)
+        {
+            if (line != "v=0")
+                return reject(error, "description must start with v=0");
+            continue;
+        }
+
+        switch (line[0])
+        {
+        case 'o':
+            origin = true;
+            break;
+
+        case 's':
+            name = true;
+            break;
+
+        case 'm':
+        {
+            if (!origin || !name)
+                return reject(error, "o= and s= must come before the first m=");
+            if (out.media.size() == max_sdp_media)
+                return reject(error, "too many media sections");
+
+            // m=<media> <port> <proto> <fmt> ...
+            auto rest = line.substr(2);
+            sdp_media media;
+            media.kind = next_token(rest);
+            auto const port = next_token(rest);
+            media.protocol = next_token(rest);
+            if (media.kind.empty() || !is_number(port) || media.protocol.empty() || rest.empty())
+                return reject(error, "malformed m= line " + std::to_string(number));
+            out.media.push_back(media);
+            break;
+        }
+
+        case 'a':
+        {
+            // Attributes of the current m-section, or of the session before the first one
+            auto& fingerprint = out.media.empty() ? out.fingerprint : out.media.back().fingerprint;
+            auto& ice_ufrag = out.media.empty() ? out.ice_ufrag : out.media.back().ice_ufrag;
+            auto& ice_pwd = out.media.empty() ? out.ice_pwd : out.media.back().ice_pwd;
+            std::string_view value;
+            if (attribute(line, "fingerprint", value))
+                fingerprint = value;
+            else if (attribute(line, "ice-ufrag", value))
+                ice_ufrag = value;
+            else if (attribute(line, "ice-pwd", value))
+                ice_pwd = value;
+            else if (!out.media.empty() && attribute(line, "mid", value))
+                out.media.back().mid = value;
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+
+    if (!origin || !name)
+        return reject(error, "missing o= or s= line");
+    if (out.media.empty())
+        return reject(error, "no media sections");
+
+    // Every section needs DTLS and ICE credentials, its own or the session's
+    for (auto const& media : out.media)
+    {
+        if (media.fingerprint.empty() && out.fingerprint.empty())
+            return reject(error, "missing fingerprint");
+        if ((media.ice_ufrag.empty() && out.ice_ufrag.empty()) ||
+            (media.ice_pwd.empty() && out.ice_pwd.empty()))
+            return reject(error, "missing ICE credentials");
+    }
+    return true;
+}
+
+std::string build_answer(std::string_view local_sdp, std::vector<sdp_candidate> const& candidates)
+{
+    // Size the buffer up front: every line may gain a CR, each candidate adds "a=" and CRLF
+    std::size_t size = local_sdp.size() + 2;
+    for (auto const& c : candidates)
+        size += c.line.size() + 4;
+    std::size_t lines = 0;
+    for (auto c : local_sdp)
+        lines += c == '\n';
+    size += lines;
+
+    std::string out;
+    out.reserve(size);
+
+    auto const append_line = [&out](std::string_view a, std::string_view b)
+    {
+        out.append(a.data(), a.size()).append(b.data(), b.size()).append("\r\n");
+    };
+
+    // Candidates of one m-section go right before the next m= line
+    auto const splice = [&](int index)
+    {
+        for (auto const& c : candidates)
+            if (c.mline_index == index)
+                append_line("a=", c.line);
+    };
+
+    int index = -1;
+    while (!local_sdp.empty())
+    {
+        auto const line = next_line(local_sdp);
+        if (line.empty())
+            continue;
+        if (line.size() > 1 && line[0] == 'm' && line[1] == '=')
+        {
+            if (index >= 0)
+                splice(index);
+            ++index;
+        }
+        append_line(line, {});
+    }
+    if (index >= 0)
+        splice(index);
+
+    // Candidates which match no m-section
+    for (auto const& c : candidates)
+        if (c.mline_index < 0 || c.mline_index > index)
+            append_line("a=", c.line);
+
+    return out;
+}
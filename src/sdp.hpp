@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Lightweight SDP handling on the io threads: offers are checked before any
+// WebRTC resources are spent on them, and answers are written in one pass.
+
+// Limits an offer must stay within
+std::size_t constexpr max_sdp_size = 64 * 1024;
+std::size_t constexpr max_sdp_line = 4096;
+std::size_t constexpr max_sdp_media = 32;
+
+// One m-section of a description. Views point into the parsed text.
+struct sdp_media
+{
+    // "audio", "video" or "application"
+    std::string_view kind;
+    std::string_view protocol;
+    std::string_view mid;
+
+    // Transport attributes, empty when given at session level only
+    std::string_view fingerprint;
+    std::string_view ice_ufrag;
+    std::string_view ice_pwd;
+};
+
+// The parts of a description needed to vet it. Views point into the parsed text.
+struct sdp_description
+{
+    // Session level transport attributes
+    std::string_view fingerprint;
+    std::string_view ice_ufrag;
+    std::string_view ice_pwd;
+
+    std::vector<sdp_media> media;
+};
+
+// An ICE candidate of the local description and the m-section it belongs to
+struct sdp_candidate
+{
+    int mline_index;
+
+    // "candidate:..." without the "a=" prefix
+    std::string line;
+};
+
+// Parse and validate a description in a single pass over its lines.
+// Returns false and describes the first problem in error.
+bool parse_sdp(std::string_view text, sdp_description& out, std::string& error);
+
+// Write the answer: the local description with every candidate added at the end
+// of its own m-section. Candidates with an unknown index go at the end.
+std::string build_answer(std::string_view local_sdp, std::vector<sdp_candidate> const& candidates);
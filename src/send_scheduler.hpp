@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+// WebRTC headers
+#include <webrtc/api/datachannelinterface.h>
+#include <webrtc/rtc_base/thread.h>
+
+// Orders the outgoing data channel messages of one peer connection by channel priority.
+// All channels of a connection share one SCTP association, so a backlog on a bulk channel
+// delays every message queued behind it. The scheduler keeps the bytes buffered inside
+// libwebrtc below a limit and holds the rest in per-channel queues, which are drained
+// highest priority first. A control message therefore waits behind at most the limit,
+// not behind the whole bulk backlog.
+class send_scheduler : public rtc::MessageHandler
+{
+    struct queue
+    {
+        rtc::scoped_refptr<webrtc::DataChannelInterface> channel;
+        int priority;
+        std::deque<webrtc::DataBuffer> messages;
+        std::uint64_t queued_bytes = 0;
+    };
+
+    // Messages are handed to libwebrtc on this thread only
+    rtc::Thread* thread_;
+
+    // Bytes libwebrtc may hold across all channels before queueing starts
+    std::uint64_t const buffered_limit_;
+
+    // Bytes a single channel may queue before send() refuses more
+    std::uint64_t const queue_limit_;
+
+    // This mutex synchronizes access to queues_
+    std::mutex mutex_;
+
+    // Sorted by descending priority
+    std::vector<queue> queues_;
+
+    // Guards against re-entry from OnBufferedAmountChange
+    bool pumping_ = false;
+
+public:
+    send_scheduler(rtc::Thread* thread, std::uint64_t buffered_limit, std::uint64_t queue_limit)
+        : thread_(thread)
+        , buffered_limit_(buffered_limit)
+        , queue_limit_(queue_limit)
+    {
+    }
+
+    ~send_scheduler()
+    {
+        // Drop a pending pump
+        thread_->Clear(this);
+    }
+
+    // Register a channel with the given priority (higher is sent first)
+    void add_channel(rtc::scoped_refptr<webrtc::DataChannelInterface> channel, int priority)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = queues_.begin();
+        while (it != queues_.end() && it->priority >= priority)
+            ++it;
+        queues_.insert(it, queue{ std::move(channel), priority });
+    }
+
+    // Unregister a channel. Its queued messages are handed to libwebrtc past the
+    // buffered limit if the channel is open, and dropped otherwise.
+    // Must be called on the signaling thread.
+    void remove_channel(webrtc::DataChannelInterface* channel)
+    {
+        std::optional<queue> removed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (auto it = queues_.begin(); it != queues_.end(); ++it)
+                if (it->channel.get() == channel)
+                {
+                    removed.emplace(std::move(*it));
+                    queues_.erase(it);
+                    break;
+                }
+        }
+        if (!removed || removed->channel->state() != webrtc::DataChannelInterface::kOpen)
+            return;
+        for (auto const& buffer : removed->messages)
+            removed->channel->Send(buffer);
+    }
+
+    // Bytes waiting in the queues
+    std::uint64_t queued_bytes()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::uint64_t total = 0;
+        for (auto const& q : queues_)
+            total += q.queued_bytes;
+        return total;
+    }
+
+    // Queue a message on a registered channel.
+    // Returns false if the channel is unknown or its queue is full.
+    bool send(webrtc::DataChannelInterface* channel, webrtc::DataBuffer const& buffer)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto q = find(channel);
+            if (!q || q->queued_bytes + buffer.size() > queue_limit_)
+                return false;
+            q->messages.push_back(buffer);
+            q->queued_bytes += buffer.size();
+        }
+
+        // Send from the signaling thread, where DataChannel::Send does not block
+        if (thread_->IsCurrent())
+            pump();
+        else
+            thread_->Post(RTC_FROM_HERE, this);
+        return true;
+    }
+
+    // Hand queued messages to libwebrtc while there is room.
+    // Must be called on the signaling thread, e.g. from OnBufferedAmountChange.
+    void pump()
+    {
+        // Sending can report a buffered amount change, which calls back in here
+        if (pumping_)
+            return;
+        pumping_ = true;
+
+        while (true)
+        {
+            rtc::scoped_refptr<webrtc::DataChannelInterface> channel;
+            std::optional<webrtc::DataBuffer> buffer;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+
+                std::uint64_t buffered = 0;
+                for (auto const& q : queues_)
+                    buffered += q.channel->buffered_amount();
+                if (buffered >= buffered_limit_)
+                    break;
+
+                // Take the next message of the highest priority open channel
+                for (auto& q : queues_)
+                {
+                    if (q.messages.empty() ||
+                        q.channel->state() != webrtc::DataChannelInterface::kOpen)
+                        continue;
+                    channel = q.channel;
+                    buffer.emplace(std::move(q.messages.front()));
+                    q.messages.pop_front();
+                    q.queued_bytes -= buffer->size();
+                    break;
+                }
+            }
+            if (!buffer)
+                break;
+            channel->Send(*buffer);
+        }
+
+        pumping_ = false;
+    }
+
+private:
+    // Posted by send() from other threads
+    void OnMessage(rtc::Message*) override
+    {
+        pump();
+    }
+
+    queue* find(webrtc::DataChannelInterface* channel)
+    {
+        for (auto& q : queues_)
+            if (q.channel.get() == channel)
+                return &q;
+        return nullptr;
+    }
+};
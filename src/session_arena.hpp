@@ -0,0 +1,41 @@
+#pragma once
+
+#include "beast.hpp"
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+
+// Allocator and message types backed by the per-session arena
+using arena_allocator = std::pmr::polymorphic_allocator<char>;
+using arena_fields = http::basic_fields<arena_allocator>;
+using arena_string_body = http::basic_string_body<char, std::char_traits<char>, arena_allocator>;
+
+// Storage of a session_arena, a base class so it is built before the arena
+struct arena_blocks
+{
+    // Blocks the arena has to fetch beyond the inline storage
+    std::pmr::unsynchronized_pool_resource pool;
+    std::array<std::byte, 8192> storage;
+
+    explicit arena_blocks(std::pmr::memory_resource* upstream) : pool(upstream) {}
+};
+
+// Per-session arena. Header fields, bodies and the response holder
+// of one request are carved out of the inline storage and released in
+// one step before the next request is read. Blocks the arena has to
+// fetch beyond the inline storage are cached by the pool so a steady
+// keep-alive connection stops touching the global heap.
+class session_arena
+    : private arena_blocks
+    , public std::pmr::monotonic_buffer_resource
+{
+public:
+    explicit session_arena(std::pmr::memory_resource* upstream)
+        : arena_blocks(upstream)
+        , monotonic_buffer_resource(storage.data(), storage.size(), &pool)
+    {
+    }
+
+    // Return the cached blocks upstream; only while nothing is allocated
+    void trim() { pool.release(); }
+};
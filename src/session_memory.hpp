@@ -0,0 +1,174 @@
+#pragma once
+
+#include "beast.hpp"
+#include "memory_budget.hpp"
+#include "session_arena.hpp"
+#include <boost/optional.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <type_traits>
+
+// Read buffer whose memory is charged to the budget
+using session_buffer = beast::basic_flat_buffer<std::pmr::polymorphic_allocator<char>>;
+
+// Request parser with header fields and body in the session's memory
+using session_parser = http::request_parser<arena_string_body, arena_allocator>;
+
+// Memory resource for request bodies. It forwards to the session arena, and is
+// pointed at the server's shared body pool for routes which take large bodies.
+// It is only switched while no body memory is allocated from it.
+class body_resource : public std::pmr::memory_resource
+{
+    std::pmr::memory_resource* upstream_;
+
+public:
+    explicit body_resource(std::pmr::memory_resource* upstream) : upstream_(upstream) {}
+
+    void use(std::pmr::memory_resource* upstream) { upstream_ = upstream; }
+
+private:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        return upstream_->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override
+    {
+        upstream_->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+    {
+        return this == &other;
+    }
+};
+
+// A response together with the serializer which sends it in chunks
+template <class BodyType>
+struct outgoing
+{
+    http::response<BodyType, arena_fields> msg;
+    http::response_serializer<BodyType, arena_fields> sr;
+
+    explicit outgoing(http::response<BodyType, arena_fields>&& res)
+        : msg(std::move(res))
+        , sr(msg)
+    {
+    }
+};
+
+// Everything an HTTP session allocates: the read buffer, and the arena
+// which holds the parser and the response of the current request.
+// bench/arena_allocations drives the same object to count heap allocations.
+class session_memory
+{
+    // Memory an idle session may keep in its read buffer and in its pool
+    static std::size_t constexpr idle_buffer_limit = 16 * 1024;
+    static std::size_t constexpr idle_pool_limit = 32 * 1024;
+
+    // Every heap allocation of the session goes through here,
+    // so its buffers are charged to the server's memory budget
+    counting_resource counting_;
+    session_buffer buffer_;
+
+    // Header fields, bodies and the response holder of one request
+    session_arena arena_;
+
+    // Request bodies come from the arena, or from the shared pool when large
+    body_resource body_resource_;
+
+    // The parser is stored in an optional container so we can
+    // construct it from scratch it at the beginning of each new message.
+    boost::optional<session_parser> parser_;
+
+    // The response being written. It lives in the arena, so it must be
+    // destroyed before the arena is released for the next request.
+    std::shared_ptr<void> res_;
+
+public:
+    explicit session_memory(memory_budget& budget)
+        : counting_(budget, memory_subsystem::http_buffers)
+        , buffer_(std::pmr::polymorphic_allocator<char>(&counting_))
+        , arena_(&counting_)
+        , body_resource_(&arena_)
+    {
+    }
+
+    session_buffer& buffer() { return buffer_; }
+
+    // The parser of the current request
+    session_parser& parser() { return *parser_; }
+
+    // Allocates from the arena, for strings that live as long as the request
+    arena_allocator allocator() { return arena_allocator(&arena_); }
+
+    // Drop everything the previous request left in the arena, give back
+    // what an idle connection shouldn't keep, and construct a new parser
+    session_parser& next_request()
+    {
+        // Nothing allocated from the arena may outlive this
+        parser_.reset();
+        res_ = nullptr;
+        arena_.release();
+        body_resource_.use(&arena_);
+
+        // A large request grows the read buffer; don't keep it
+        // for the rest of the connection once it has been consumed
+        if (buffer_.size() == 0 && buffer_.capacity() > idle_buffer_limit)
+            buffer_.shrink_to_fit();
+
+        // Same for blocks the pool cached after a large response
+        if (counting_.outstanding() > buffer_.capacity() + idle_pool_limit)
+            arena_.trim();
+
+        // Header fields come from the arena, the body through body_resource_
+        parser_.emplace(
+            std::piecewise_construct,
+            std::make_tuple(arena_allocator(&body_resource_)),
+            std::make_tuple(arena_allocator(&arena_)));
+        return *parser_;
+    }
+
+    // Read the body of the current request into a shared pool instead of the arena.
+    // Only before any of the body is read.
+    void use_body_pool(std::pmr::memory_resource* pool) { body_resource_.use(pool); }
+
+    // A response whose fields, and string body if any, live in the arena
+    template <class BodyType>
+    http::response<BodyType, arena_fields> make_response(http::status status, unsigned version)
+    {
+        // Bodies which allocate (strings) share the arena with the fields
+        if constexpr (std::is_constructible<typename BodyType::value_type, arena_allocator>::value)
+            return http::response<BodyType, arena_fields>{
+                std::piecewise_construct,
+                std::make_tuple(arena_allocator(&arena_)),
+                std::make_tuple(status, version, arena_allocator(&arena_)) };
+        else
+            return http::response<BodyType, arena_fields>{
+                std::piecewise_construct,
+                std::make_tuple(),
+                std::make_tuple(status, version, arena_allocator(&arena_)) };
+    }
+
+    // Keep a response and its serializer in the arena until release_response() or
+    // the next request. The message is placed in the arena by hand: allocate_shared
+    // would treat it as allocator-aware and try to hand the allocator to the body.
+    // Memory is reclaimed when the arena is released, so the deleter only destroys.
+    template <class BodyType>
+    outgoing<BodyType>& hold(http::response<BodyType, arena_fields>&& res)
+    {
+        using outgoing_type = outgoing<BodyType>;
+        std::pmr::polymorphic_allocator<outgoing_type> alloc(&arena_);
+        auto sp = std::shared_ptr<outgoing_type>(
+            ::new (alloc.allocate(1)) outgoing_type(std::move(res)),
+            [](outgoing_type* p) { p->~outgoing_type(); },
+            alloc);
+        res_ = sp;
+        return *sp;
+    }
+
+    // Done with the response being written
+    void release_response() { res_ = nullptr; }
+};
@@ -1,8 +1,15 @@
 #include "shared_state.hpp"
 #include "webrtc_session.hpp"
 
-shared_state::shared_state(std::string doc_root)
+shared_state::shared_state(std::string doc_root, std::uint64_t memory_limit)
     : doc_root_(doc_root)
+    , ready_(false)
+    , sessions_(0)
+    , memory_(memory_limit)
+    , body_counting_(memory_, memory_subsystem::http_buffers)
+    , body_pool_(std::pmr::pool_options{ 4, 256 * 1024 }, &body_counting_)
+    , broker_(memory_)
+    , broker_only_(false)
     , answer_ready_state(false)
 {
 }
@@ -35,6 +42,22 @@ void shared_state::set_answer_payload(std::string const& message)
     answer_payload_ = message;
 }
 
+// Initialize the WebRTC engine ahead of the first offer
+void shared_state::warm_up(std::shared_ptr<shared_state> const& state, warm_up_options const& options)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!webrtc_session_)
+        webrtc_session_ = std::make_shared<webrtc_session>(state, options);
+    ready_ = true;
+}
+
+// Serve as a signaling broker only; the WebRTC engine is never started
+void shared_state::start_broker_only()
+{
+    broker_only_ = true;
+    ready_ = true;
+}
+
 // Create new webrtc_session in shared-state
 void shared_state::create_session(std::shared_ptr<shared_state> const& state)
 {
@@ -42,11 +65,41 @@ void shared_state::create_session(std::shared_ptr<shared_state> const& state)
     // If webrtc_session is already created, do nothing
     if (!webrtc_session_)
         webrtc_session_ = std::make_shared<webrtc_session>(state);
+    ready_ = true;
 }
 
-// Create new webrtc connection in shared-state
-void shared_state::create_connection(std::string const& offer_message)
+// Create new webrtc connection in shared-state,
+// unless another peer connection would exceed the memory budget
+bool shared_state::create_connection(std::string const& offer_message)
 {
     std::lock_guard<std::mutex> lock(mutex_);
+    if (!memory_.admits(peer_connection_estimate, webrtc_session_->footprints()))
+        return false;
     webrtc_session_->create_connection(offer_message);
+    return true;
+}
+
+// Number of peer connections that are still up
+std::size_t shared_state::connection_count()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return webrtc_session_ ? webrtc_session_->connection_count() : 0;
+}
+
+// Get stats JSON payload, server-wide or for one peer connection
+std::string shared_state::stats_payload(std::string const& peer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!webrtc_session_)
+        return {};
+    return peer.empty() ?
+        webrtc_session_->stats().to_json() :
+        webrtc_session_->stats().peer_json(peer);
+}
+
+// Get memory use JSON payload
+std::string shared_state::memory_payload()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return memory_.to_json(webrtc_session_ ? webrtc_session_->footprints() : std::vector<peer_footprint>{});
 }
\ No newline at end of file
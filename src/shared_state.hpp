@@ -1,12 +1,32 @@
 #pragma once
 
+#include "memory_budget.hpp"
+#include "signaling_broker.hpp"
+
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <memory_resource>
 #include <mutex>
+#include <string>
 #include <unordered_set>
 
 // Forward declaration
 class webrtc_session;
 
+// Optional work done while warming up the WebRTC engine
+struct warm_up_options
+{
+    // Build the codec factory tables
+    bool prewarm_codecs = true;
+
+    // Generate the DTLS certificate shared by all peer connections
+    bool generate_certificate = true;
+
+    // How often each peer connection's stats are sampled
+    std::chrono::milliseconds stats_interval{ 5000 };
+};
+
 // Represents the shared server state
 class shared_state
 {
@@ -19,19 +39,52 @@ class shared_state
     // webrtc_session pointer
     std::shared_ptr<webrtc_session> webrtc_session_;
 
+    // Set once the WebRTC engine is initialized
+    std::atomic<bool> ready_;
+
+    // Live HTTP sessions
+    std::atomic<std::size_t> sessions_;
+
+    // Memory accounting and the limit new peer connections are admitted against
+    memory_budget memory_;
+
+    // Large request bodies of all sessions are read into this pool.
+    // Sessions on every io thread allocate through body_counting_.
+    counting_resource body_counting_;
+    std::pmr::synchronized_pool_resource body_pool_;
+
+    // Relays signaling between browsers; locks its own shards, not mutex_
+    signaling_broker broker_;
+
+    // Relay signaling only, without the WebRTC engine
+    std::atomic<bool> broker_only_;
+
     // webrtc connection state
     bool answer_ready_state;
     std::string answer_payload_;
 
 public:
-    explicit shared_state(std::string doc_root);
+    shared_state(std::string doc_root, std::uint64_t memory_limit);
 
-    auto doc_root() { return doc_root_; }
+    std::string const& doc_root() const { return doc_root_; }
     
+    bool is_ready() const { return ready_; }
+    void session_opened() { ++sessions_; }
+    void session_closed() { --sessions_; }
+    std::size_t session_count() const { return sessions_; }
+    std::size_t connection_count();
+    memory_budget& memory() { return memory_; }
+    signaling_broker& broker() { return broker_; }
+    std::pmr::memory_resource* body_pool() { return &body_pool_; }
+    bool is_broker_only() const { return broker_only_; }
+    void start_broker_only();
     bool is_answer_ready();
     void set_answer_ready_state(bool state);
     std::string get_answer_payload();
     void set_answer_payload(std::string const& payload);
+    void warm_up(std::shared_ptr<shared_state> const& state, warm_up_options const& options);
     void create_session(std::shared_ptr<shared_state> const& state);
-    void create_connection(std::string const& offer_message);
+    bool create_connection(std::string const& offer_message);
+    std::string stats_payload(std::string const& peer);
+    std::string memory_payload();
 };
\ No newline at end of file
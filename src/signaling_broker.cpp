@@ -0,0 +1,324 @@
+#include "signaling_broker.hpp"
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+namespace {
+
+// Hash map nodes of a peer, in the mailbox and the room maps
+std::size_t constexpr node_overhead = 128;
+
+}
+
+std::string signaling_broker::key(std::string const& room, std::string const& peer)
+{
+    // Room names can't contain a NUL, so the key is unambiguous
+    std::string k;
+    k.reserve(room.size() + 1 + peer.size());
+    k.append(room).push_back('\0');
+    k.append(peer);
+    return k;
+}
+
+signaling_broker::peer_shard& signaling_broker::peer_shard_for(std::string const& key)
+{
+    return peer_shards_[std::hash<std::string>()(key) % shard_count];
+}
+
+signaling_broker::room_shard& signaling_broker::room_shard_for(std::string const& room)
+{
+    return room_shards_[std::hash<std::string>()(room) % shard_count];
+}
+
+signaling_broker::result signaling_broker::join(std::string const& room, std::string const& peer)
+{
+    auto const k = key(room, peer);
+    auto const now = std::chrono::steady_clock::now();
+    auto& shard = peer_shard_for(k);
+
+    // Idle peers go first, so they don't count against the limits
+    sweep(shard, now);
+
+    // A known peer is only refreshed
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mailboxes.find(k);
+        if (it != shard.mailboxes.end())
+        {
+            it->second.seen = now;
+            return result::ok;
+        }
+    }
+
+    // A new peer is charged for its mailbox: the key, the names and the map nodes
+    if (peer_count_++ >= max_peers)
+    {
+        --peer_count_;
+        return result::too_many_peers;
+    }
+    auto const cost = sizeof(mailbox) + 2 * k.size() + node_overhead;
+    if (!budget_.try_charge(memory_subsystem::broker, cost))
+    {
+        --peer_count_;
+        return result::over_budget;
+    }
+    auto const refund = [this, cost]
+    {
+        --peer_count_;
+        budget_.charge(memory_subsystem::broker, -static_cast<std::int64_t>(cost));
+    };
+
+    {
+        auto& rooms = room_shard_for(room);
+        std::lock_guard<std::mutex> lock(rooms.mutex);
+        auto& members = rooms.rooms[room];
+        if (members.size() >= max_room_peers && members.count(peer) == 0)
+        {
+            refund();
+            return result::room_full;
+        }
+        members.insert(peer);
+    }
+
+    bool inserted;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto const entry = shard.mailboxes.try_emplace(k);
+        inserted = entry.second;
+        auto& box = entry.first->second;
+        if (inserted)
+        {
+            box.room = room;
+            box.peer = peer;
+            box.cost = cost;
+        }
+        box.seen = now;
+    }
+
+    // The same peer joined concurrently and was charged already
+    if (!inserted)
+        refund();
+    return result::ok;
+}
+
+void signaling_broker::leave(std::string const& room, std::string const& peer)
+{
+    auto const k = key(room, peer);
+    waiter pending;
+    {
+        auto& shard = peer_shard_for(k);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mailboxes.find(k);
+        if (it == shard.mailboxes.end())
+            return;
+        pending = std::move(it->second.pending);
+        release(it->second);
+        shard.mailboxes.erase(it);
+    }
+    remove_from_room(room, peer);
+
+    if (pending)
+        pending("[]");
+}
+
+std::string signaling_broker::peers(std::string const& room)
+{
+    rapidjson::StringBuffer strbuf;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
+    writer.StartArray();
+    {
+        auto& rooms = room_shard_for(room);
+        std::lock_guard<std::mutex> lock(rooms.mutex);
+        auto it = rooms.rooms.find(room);
+        if (it != rooms.rooms.end())
+            for (auto const& peer : it->second)
+                writer.String(peer.c_str(), static_cast<rapidjson::SizeType>(peer.size()));
+    }
+    writer.EndArray();
+    return strbuf.GetString();
+}
+
+signaling_broker::result signaling_broker::send(
+    std::string const& room,
+    std::string const& from,
+    std::string const& to,
+    std::string const& data)
+{
+    // Only a member of the room sends, and sending keeps it from being swept
+    {
+        auto const sender = key(room, from);
+        auto& shard = peer_shard_for(sender);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mailboxes.find(sender);
+        if (it == shard.mailboxes.end())
+            return result::unknown_peer;
+        it->second.seen = std::chrono::steady_clock::now();
+    }
+
+    // Encode outside the lock: {"from":"<from>","data":"<data>"}
+    rapidjson::StringBuffer strbuf;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
+    writer.StartObject();
+    writer.Key("from");
+    writer.String(from.c_str(), static_cast<rapidjson::SizeType>(from.size()));
+    writer.Key("data");
+    writer.String(data.c_str(), static_cast<rapidjson::SizeType>(data.size()));
+    writer.EndObject();
+    std::string message(strbuf.GetString(), strbuf.GetSize());
+
+    auto const k = key(room, to);
+    waiter pending;
+    std::string ready;
+    {
+        auto& shard = peer_shard_for(k);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mailboxes.find(k);
+        if (it == shard.mailboxes.end())
+            return result::unknown_peer;
+        auto& box = it->second;
+        if (box.messages.size() >= max_messages || box.bytes + message.size() > max_bytes)
+            return result::mailbox_full;
+        if (!budget_.try_charge(memory_subsystem::broker, message.size()))
+            return result::over_budget;
+        box.bytes += message.size();
+        box.messages.push_back(std::move(message));
+
+        // Complete the waiting poll
+        if (box.pending)
+        {
+            pending = std::move(box.pending);
+            box.pending = nullptr;
+            box.token = 0;
+            ready = drain(box);
+        }
+    }
+    if (pending)
+        pending(std::move(ready));
+    return result::ok;
+}
+
+std::uint64_t signaling_broker::poll(
+    std::string const& room,
+    std::string const& peer,
+    waiter w,
+    result& r)
+{
+    auto const k = key(room, peer);
+    waiter replaced;
+    std::string ready;
+    std::uint64_t token = 0;
+    {
+        auto& shard = peer_shard_for(k);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mailboxes.find(k);
+        if (it == shard.mailboxes.end())
+        {
+            r = result::unknown_peer;
+            return 0;
+        }
+        r = result::ok;
+        auto& box = it->second;
+        box.seen = std::chrono::steady_clock::now();
+
+        // An older poll of the same peer gets nothing
+        replaced = std::move(box.pending);
+        box.pending = nullptr;
+        box.token = 0;
+
+        if (!box.messages.empty())
+            ready = drain(box);
+        else
+        {
+            token = next_token_++;
+            box.pending = std::move(w);
+            box.token = token;
+        }
+    }
+    if (replaced)
+        replaced("[]");
+    if (!token)
+        w(std::move(ready));
+    return token;
+}
+
+bool signaling_broker::cancel(std::string const& room, std::string const& peer, std::uint64_t token)
+{
+    auto const k = key(room, peer);
+    waiter pending;
+    {
+        auto& shard = peer_shard_for(k);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.mailboxes.find(k);
+        if (it == shard.mailboxes.end() || it->second.token != token)
+            return false;
+        auto& box = it->second;
+        box.seen = std::chrono::steady_clock::now();
+
+        // Destroyed outside the lock, it may own the last session reference
+        pending = std::move(box.pending);
+        box.pending = nullptr;
+        box.token = 0;
+    }
+    return true;
+}
+
+std::string signaling_broker::drain(mailbox& box)
+{
+    std::string out;
+    out.reserve(box.bytes + box.messages.size() + 2);
+    out.push_back('[');
+    for (auto const& message : box.messages)
+    {
+        if (out.size() > 1)
+            out.push_back(',');
+        out.append(message);
+    }
+    out.push_back(']');
+    budget_.charge(memory_subsystem::broker, -static_cast<std::int64_t>(box.bytes));
+    box.messages.clear();
+    box.bytes = 0;
+    return out;
+}
+
+void signaling_broker::release(mailbox const& box)
+{
+    --peer_count_;
+    budget_.charge(memory_subsystem::broker, -static_cast<std::int64_t>(box.cost + box.bytes));
+}
+
+void signaling_broker::sweep(peer_shard& shard, std::chrono::steady_clock::time_point now)
+{
+    // At most once per timeout and shard, so joins stay cheap
+    std::vector<std::pair<std::string, std::string>> removed;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (now - shard.swept < idle_timeout)
+            return;
+        shard.swept = now;
+        for (auto it = shard.mailboxes.begin(); it != shard.mailboxes.end();)
+        {
+            if (!it->second.pending && now - it->second.seen >= idle_timeout)
+            {
+                release(it->second);
+                removed.emplace_back(std::move(it->second.room), std::move(it->second.peer));
+                it = shard.mailboxes.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+    for (auto const& entry : removed)
+        remove_from_room(entry.first, entry.second);
+}
+
+void signaling_broker::remove_from_room(std::string const& room, std::string const& peer)
+{
+    auto& rooms = room_shard_for(room);
+    std::lock_guard<std::mutex> lock(rooms.mutex);
+    auto it = rooms.rooms.find(room);
+    if (it == rooms.rooms.end())
+        return;
+    it->second.erase(peer);
+    if (it->second.empty())
+        rooms.rooms.erase(it);
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "memory_budget.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Relays signaling messages (offers, answers, candidates) between the peers of a room.
+// Peers and rooms live in hash maps split into shards with a mutex each, so routing
+// a message locks one shard for an O(1) lookup and never touches shared_state.
+// Each peer has a mailbox; a long-poll waiting on it is completed by the next message.
+// Mailboxes and queued messages are charged to the server's memory budget.
+class signaling_broker
+{
+public:
+    // Receives the messages of a mailbox as one JSON array
+    using waiter = std::function<void(std::string)>;
+
+    enum class result
+    {
+        ok,
+        unknown_peer,
+        mailbox_full,
+        room_full,
+        too_many_peers,
+        over_budget
+    };
+
+    // Queued messages a mailbox holds before send() refuses more
+    static std::size_t constexpr max_messages = 256;
+    static std::size_t constexpr max_bytes = 256 * 1024;
+
+    // Peers a room, and the whole broker, hold before join() refuses more
+    static std::size_t constexpr max_room_peers = 64;
+    static std::size_t constexpr max_peers = 16384;
+
+    // A peer that neither polls nor sends for this long is dropped
+    static constexpr std::chrono::seconds idle_timeout{ 60 };
+
+    explicit signaling_broker(memory_budget& budget) : budget_(budget) {}
+
+    // Add a peer to a room, or refresh it
+    result join(std::string const& room, std::string const& peer);
+
+    // Remove a peer from a room; a pending poll is answered with no messages
+    void leave(std::string const& room, std::string const& peer);
+
+    // The peers of a room as a JSON array
+    std::string peers(std::string const& room);
+
+    // Queue a message from one peer of a room to another; both have to have joined
+    result send(std::string const& room, std::string const& from, std::string const& to, std::string const& data);
+
+    // Hand the queued messages of a peer to w, now if there are any or else with
+    // the next message. Returns the token to cancel a waiting poll with, or 0 if
+    // w was already called. Only one poll waits per peer; a new one replaces it.
+    std::uint64_t poll(std::string const& room, std::string const& peer, waiter w, result& r);
+
+    // Give up a waiting poll. Returns false if it was completed in the meantime.
+    bool cancel(std::string const& room, std::string const& peer, std::uint64_t token);
+
+private:
+    struct mailbox
+    {
+        std::string room;
+        std::string peer;
+        std::deque<std::string> messages;
+        std::size_t bytes = 0;
+
+        // Charged for the mailbox itself, besides the messages
+        std::size_t cost = 0;
+        waiter pending;
+        std::uint64_t token = 0;
+        std::chrono::steady_clock::time_point seen;
+    };
+
+    struct peer_shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, mailbox> mailboxes;
+        std::chrono::steady_clock::time_point swept;
+    };
+
+    struct room_shard
+    {
+        std::mutex mutex;
+        std::unordered_map<std::string, std::unordered_set<std::string>> rooms;
+    };
+
+    static std::size_t constexpr shard_count = 64;
+
+    memory_budget& budget_;
+    std::array<peer_shard, shard_count> peer_shards_;
+    std::array<room_shard, shard_count> room_shards_;
+    std::atomic<std::uint64_t> next_token_{ 1 };
+    std::atomic<std::size_t> peer_count_{ 0 };
+
+    static std::string key(std::string const& room, std::string const& peer);
+    peer_shard& peer_shard_for(std::string const& key);
+    room_shard& room_shard_for(std::string const& room);
+    std::string drain(mailbox& box);
+    void release(mailbox const& box);
+    void sweep(peer_shard& shard, std::chrono::steady_clock::time_point now);
+    void remove_from_room(std::string const& room, std::string const& peer);
+};
@@ -0,0 +1,290 @@
+#include "socket_handoff.hpp"
+
+#if !defined(_WIN32)
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+// Most sockets passed in one message
+std::size_t constexpr max_listeners = 16;
+
+// Longest wait for the old server at each step of the handoff
+int constexpr handoff_timeout_ms = 5000;
+
+// Whether the process at the other end of a Unix socket runs as our user
+bool same_user(int fd)
+{
+#if defined(__linux__)
+    ucred cred{};
+    socklen_t len = sizeof(cred);
+    if (::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+        return false;
+    return cred.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    if (::getpeereid(fd, &uid, &gid) != 0)
+        return false;
+    return uid == ::geteuid();
+#endif
+}
+
+// Wait until fd is readable, failing with timed_out after handoff_timeout_ms
+bool wait_readable(int fd, beast::error_code& ec)
+{
+    pollfd p{ fd, POLLIN, 0 };
+    int n;
+    do
+        n = ::poll(&p, 1, handoff_timeout_ms);
+    while (n < 0 && errno == EINTR);
+    if (n < 0)
+        ec.assign(errno, beast::system_category());
+    else if (n == 0)
+        ec = net::error::timed_out;
+    return n > 0;
+}
+
+}
+
+std::string handoff_socket_path(std::string const& name, beast::error_code& ec)
+{
+    auto const runtime = std::getenv("XDG_RUNTIME_DIR");
+    auto const dir = runtime && *runtime ?
+        std::string(runtime) + "/" + name :
+        "/tmp/" + name + "-" + std::to_string(::geteuid());
+
+    if (::mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST)
+    {
+        ec.assign(errno, beast::system_category());
+        return {};
+    }
+
+    // Someone else may have created it first, in a shared /tmp
+    struct stat st;
+    if (::lstat(dir.c_str(), &st) != 0)
+    {
+        ec.assign(errno, beast::system_category());
+        return {};
+    }
+    if (!S_ISDIR(st.st_mode) || st.st_uid != ::geteuid() || (st.st_mode & 077) != 0)
+    {
+        ec = boost::system::errc::make_error_code(boost::system::errc::permission_denied);
+        return {};
+    }
+    return dir + "/handoff.sock";
+}
+
+std::vector<native_listener>
+take_listeners(std::string const& path, beast::error_code& ec)
+{
+    using local = net::local::stream_protocol;
+    std::vector<native_listener> result;
+
+    // Nobody to take over from: no socket file, or a stale one.
+    // The socket is non-blocking, so a server too busy to accept can't hold us up.
+    net::io_context ioc;
+    local::socket socket(ioc);
+    socket.open(local(), ec);
+    if (ec)
+        return result;
+    socket.non_blocking(true, ec);
+    if (ec)
+        return result;
+    socket.connect(local::endpoint(path), ec);
+    if (ec == boost::system::errc::no_such_file_or_directory || ec == net::error::connection_refused)
+    {
+        ec = {};
+        return result;
+    }
+    if (ec)
+        return result;
+
+    // Only adopt sockets from a server of our own user
+    if (!same_user(socket.native_handle()))
+    {
+        ec = boost::system::errc::make_error_code(boost::system::errc::permission_denied);
+        return result;
+    }
+
+    // The old server sends the descriptors as soon as we connect
+    if (!wait_readable(socket.native_handle(), ec))
+        return result;
+    char count = 0;
+    iovec iov{ &count, 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_listeners)];
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (::recvmsg(socket.native_handle(), &msg, MSG_CMSG_CLOEXEC) <= 0)
+    {
+        ec.assign(errno, beast::system_category());
+        return result;
+    }
+    for (auto cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        auto const n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            int fd;
+            std::memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            result.push_back(fd);
+        }
+    }
+    if (result.size() != static_cast<std::size_t>(count))
+    {
+        for (auto fd : result)
+            ::close(fd);
+        result.clear();
+        ec = net::error::message_size;
+        return result;
+    }
+
+    // Acknowledge: the sockets stay open through us from here on
+    if (::send(socket.native_handle(), "k", 1, MSG_NOSIGNAL) != 1)
+    {
+        ec.assign(errno, beast::system_category());
+        return result;
+    }
+
+    // The old server closes the connection after it stopped accepting.
+    // If it doesn't in time, both processes accept for a while.
+    if (!wait_readable(socket.native_handle(), ec))
+        return result;
+    char eof;
+    if (::recv(socket.native_handle(), &eof, 1, 0) < 0)
+        ec.assign(errno, beast::system_category());
+    return result;
+}
+
+handoff_server::handoff_server(
+    net::io_context& ioc,
+    std::string path,
+    std::vector<native_listener> listeners,
+    std::function<void()> on_handoff)
+    : path_(std::move(path))
+    , acceptor_(net::make_strand(ioc))
+    , peer_(acceptor_.get_executor())
+    , listeners_(std::move(listeners))
+    , on_handoff_(std::move(on_handoff))
+{
+    beast::error_code ec;
+
+    // Replace the socket file of the previous process
+    ::unlink(path_.c_str());
+
+    acceptor_.open(local(), ec);
+    if (ec)
+    {
+        fail(ec, "handoff open");
+        return;
+    }
+
+    acceptor_.bind(local::endpoint(path_), ec);
+    if (ec)
+    {
+        fail(ec, "handoff bind");
+        return;
+    }
+
+    acceptor_.listen(1, ec);
+    if (ec)
+    {
+        fail(ec, "handoff listen");
+        return;
+    }
+}
+
+void handoff_server::run()
+{
+    if (listeners_.size() > max_listeners)
+        return fail(beast::error_code(net::error::message_size), "handoff");
+
+    if (acceptor_.is_open())
+        do_accept();
+}
+
+void handoff_server::do_accept()
+{
+    acceptor_.async_accept(
+        peer_,
+        beast::bind_front_handler(
+            &handoff_server::on_accept,
+            shared_from_this()));
+}
+
+void handoff_server::on_accept(beast::error_code ec)
+{
+    if (ec)
+    {
+        fail(ec, "handoff accept");
+        return do_accept();
+    }
+
+    // Only a process of our own user may take the sockets
+    if (!same_user(peer_.native_handle()))
+    {
+        fail(boost::system::errc::make_error_code(boost::system::errc::permission_denied), "handoff peer");
+        peer_.close(ec);
+        return do_accept();
+    }
+
+    // Pass every listening socket in one message
+    char count = static_cast<char>(listeners_.size());
+    iovec iov{ &count, 1 };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * max_listeners)] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * listeners_.size());
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * listeners_.size());
+    std::memcpy(CMSG_DATA(cmsg), listeners_.data(), sizeof(int) * listeners_.size());
+
+    if (::sendmsg(peer_.native_handle(), &msg, MSG_NOSIGNAL) < 0)
+    {
+        fail(beast::error_code(errno, beast::system_category()), "handoff send");
+        peer_.close(ec);
+        return do_accept();
+    }
+
+    // Keep accepting until the new process confirms it has the sockets
+    peer_.async_read_some(
+        net::buffer(&ack_, 1),
+        beast::bind_front_handler(
+            &handoff_server::on_ack,
+            shared_from_this()));
+}
+
+void handoff_server::on_ack(beast::error_code ec, std::size_t)
+{
+    if (ec)
+    {
+        // The new process went away, so we stay in charge
+        fail(ec, "handoff ack");
+        peer_.close(ec);
+        return do_accept();
+    }
+
+    // The new process owns the socket file now; closing
+    // the connection tells it we stopped accepting
+    on_handoff_();
+    acceptor_.close(ec);
+    peer_.close(ec);
+}
+
+#endif
@@ -0,0 +1,59 @@
+#pragma once
+
+// Listening socket handoff between an old and a new server process.
+// Passing descriptors needs SCM_RIGHTS over a Unix domain socket, so this is POSIX only.
+#if !defined(_WIN32)
+
+#include "beast.hpp"
+#include <boost/asio/local/stream_protocol.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+using native_listener = tcp::acceptor::native_handle_type;
+
+// Path of the handoff socket, in a directory only this user can enter:
+// $XDG_RUNTIME_DIR/<name>, or /tmp/<name>-<uid> without a runtime directory.
+// The directory is created if missing; one which is not private is refused.
+std::string handoff_socket_path(std::string const& name, beast::error_code& ec);
+
+// Take over the listening sockets of the server running at path.
+// The old server stops accepting once they are acknowledged, so the
+// sockets never go without an accepting process. Only a server of the
+// same user is trusted, and each step waits a few seconds at most.
+// Returns an empty vector if no server is running there.
+std::vector<native_listener>
+take_listeners(std::string const& path, beast::error_code& ec);
+
+// Hands the listening sockets of this process to the next one, if it runs as the same user
+class handoff_server : public std::enable_shared_from_this<handoff_server>
+{
+    using local = net::local::stream_protocol;
+
+    std::string const path_;
+    local::acceptor acceptor_;
+    local::socket peer_;
+    std::vector<native_listener> const listeners_;
+    char ack_;
+
+    // Called once the new process accepts on the sockets
+    std::function<void()> on_handoff_;
+
+public:
+    handoff_server(
+        net::io_context& ioc,
+        std::string path,
+        std::vector<native_listener> listeners,
+        std::function<void()> on_handoff);
+
+    // Start waiting for the next process
+    void run();
+
+private:
+    void do_accept();
+    void on_accept(beast::error_code ec);
+    void on_ack(beast::error_code ec, std::size_t);
+};
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+// Run one startup phase and log how long it took
+template <class Function>
+void startup_phase(char const* name, Function&& f)
+{
+    auto const start = std::chrono::steady_clock::now();
+    std::forward<Function>(f)();
+    auto const elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+    std::cout << "Startup phase \"" << name << "\" : "
+        << elapsed.count() / 1000.0 << " ms" << std::endl;
+}
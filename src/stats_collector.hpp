@@ -0,0 +1,352 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// WebRTC headers
+#include <webrtc/api/peerconnectioninterface.h>
+#include <webrtc/api/stats/rtcstats_objects.h>
+#include <webrtc/api/stats/rtcstatscollectorcallback.h>
+#include <webrtc/rtc_base/thread.h>
+
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+// Transport health of one peer connection, from its latest stats report
+struct peer_stats
+{
+    double rtt_ms = 0;
+    std::uint64_t bytes_sent = 0;
+    std::uint64_t bytes_received = 0;
+    std::uint64_t messages_sent = 0;
+    std::uint64_t messages_received = 0;
+    std::uint64_t buffered_amount = 0;
+    std::string local_candidate;
+    std::string remote_candidate;
+    std::chrono::steady_clock::time_point sampled_at;
+};
+
+// Samples GetStats on every registered peer connection and keeps
+// compact per-connection results and server-wide aggregates.
+// Polls are spread over the interval, one connection per tick,
+// so a large number of peers is never sampled all at once.
+class stats_collector : public rtc::MessageHandler
+{
+    struct peer
+    {
+        rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
+
+        // Bytes queued on the peer's data channels, read when a report arrives
+        std::function<std::uint64_t()> buffered_amount;
+
+        bool sampled = false;
+        peer_stats stats;
+    };
+
+    // Receives one report and folds it into the collector, if that still exists.
+    // Reports are delivered on the signaling thread, where the collector is torn down.
+    class callback : public webrtc::RTCStatsCollectorCallback
+    {
+        stats_collector* const parent;
+        std::weak_ptr<void> const alive;
+        std::string const uuid;
+
+    public:
+        callback(stats_collector* parent, std::weak_ptr<void> alive, std::string uuid)
+            : parent(parent)
+            , alive(std::move(alive))
+            , uuid(std::move(uuid))
+        {
+        }
+
+        void OnStatsDelivered(const rtc::scoped_refptr<const webrtc::RTCStatsReport>& report) override
+        {
+            if (!alive.expired())
+                parent->fold(uuid, *report);
+        }
+    };
+
+    // Polls and reports are handled on this thread
+    rtc::Thread* thread_;
+    std::chrono::milliseconds interval_;
+    std::atomic<bool> running_{ false };
+
+    // Expires when the collector is destroyed, for the callbacks still out
+    std::shared_ptr<void> alive_ = std::make_shared<int>(0);
+
+    // This mutex synchronizes access to peers_
+    mutable std::mutex mutex_;
+    std::map<std::string, peer> peers_;
+
+    // Next connection to poll
+    std::string cursor_;
+
+public:
+    stats_collector(rtc::Thread* thread, std::chrono::milliseconds interval)
+        : thread_(thread)
+        , interval_(interval)
+    {
+    }
+
+    ~stats_collector()
+    {
+        // Expire the token on the signaling thread, between two reports.
+        // A stopped thread runs nothing, and delivers no more reports.
+        stop();
+        thread_->Invoke<void>(RTC_FROM_HERE, [this] { alive_.reset(); });
+        alive_.reset();
+    }
+
+    // Start sampling
+    void start()
+    {
+        if (!running_.exchange(true))
+            thread_->PostDelayed(RTC_FROM_HERE, static_cast<int>(tick().count()), this);
+    }
+
+    // Stop sampling; reports already requested are still folded in.
+    // The pending tick is cleared on the signaling thread, so a tick
+    // running there can't schedule another one after this returns.
+    void stop()
+    {
+        running_ = false;
+        thread_->Invoke<void>(RTC_FROM_HERE, [this] { thread_->Clear(this); });
+    }
+
+    // Register a peer connection to be sampled
+    void add(
+        std::string const& uuid,
+        rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection,
+        std::function<std::uint64_t()> buffered_amount)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& p = peers_[uuid];
+        p.peer_connection = std::move(peer_connection);
+        p.buffered_amount = std::move(buffered_amount);
+        p.sampled = false;
+    }
+
+    // Stop sampling a peer connection
+    void remove(std::string const& uuid)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        peers_.erase(uuid);
+    }
+
+    // Server-wide aggregates and a compact line per connection, as JSON
+    std::string to_json() const
+    {
+        rapidjson::StringBuffer strbuf;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        peer_stats total;
+        double rtt_sum = 0, rtt_max = 0;
+        std::size_t sampled = 0;
+        for (auto const& p : peers_)
+        {
+            if (!p.second.sampled)
+                continue;
+            auto const& s = p.second.stats;
+            ++sampled;
+            rtt_sum += s.rtt_ms;
+            rtt_max = std::max(rtt_max, s.rtt_ms);
+            total.bytes_sent += s.bytes_sent;
+            total.bytes_received += s.bytes_received;
+            total.messages_sent += s.messages_sent;
+            total.messages_received += s.messages_received;
+            total.buffered_amount += s.buffered_amount;
+        }
+
+        writer.StartObject();
+        writer.Key("connections");
+        writer.Uint64(peers_.size());
+        writer.Key("sampled");
+        writer.Uint64(sampled);
+        writer.Key("rtt_ms_avg");
+        writer.Double(sampled ? rtt_sum / sampled : 0);
+        writer.Key("rtt_ms_max");
+        writer.Double(rtt_max);
+        writer.Key("bytes_sent");
+        writer.Uint64(total.bytes_sent);
+        writer.Key("bytes_received");
+        writer.Uint64(total.bytes_received);
+        writer.Key("messages_sent");
+        writer.Uint64(total.messages_sent);
+        writer.Key("messages_received");
+        writer.Uint64(total.messages_received);
+        writer.Key("buffered_amount");
+        writer.Uint64(total.buffered_amount);
+
+        writer.Key("peers");
+        writer.StartArray();
+        for (auto const& p : peers_)
+        {
+            if (!p.second.sampled)
+                continue;
+            writer.StartObject();
+            writer.Key("uuid");
+            writer.String(p.first.c_str());
+            writer.Key("rtt_ms");
+            writer.Double(p.second.stats.rtt_ms);
+            writer.Key("buffered_amount");
+            writer.Uint64(p.second.stats.buffered_amount);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.EndObject();
+        return strbuf.GetString();
+    }
+
+    // Latest full sample of one connection as JSON, or an empty string if there is none
+    std::string peer_json(std::string const& uuid) const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = peers_.find(uuid);
+        if (it == peers_.end() || !it->second.sampled)
+            return {};
+        auto const& s = it->second.stats;
+
+        rapidjson::StringBuffer strbuf;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
+        writer.StartObject();
+        writer.Key("uuid");
+        writer.String(uuid.c_str());
+        writer.Key("age_ms");
+        writer.Int64(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - s.sampled_at).count());
+        writer.Key("rtt_ms");
+        writer.Double(s.rtt_ms);
+        writer.Key("bytes_sent");
+        writer.Uint64(s.bytes_sent);
+        writer.Key("bytes_received");
+        writer.Uint64(s.bytes_received);
+        writer.Key("messages_sent");
+        writer.Uint64(s.messages_sent);
+        writer.Key("messages_received");
+        writer.Uint64(s.messages_received);
+        writer.Key("buffered_amount");
+        writer.Uint64(s.buffered_amount);
+        writer.Key("local_candidate");
+        writer.String(s.local_candidate.c_str());
+        writer.Key("remote_candidate");
+        writer.String(s.remote_candidate.c_str());
+        writer.EndObject();
+        return strbuf.GetString();
+    }
+
+private:
+    // Time between two polls, so that every connection is polled once per interval
+    std::chrono::milliseconds tick() const
+    {
+        std::size_t count;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            count = peers_.size();
+        }
+        auto const step = count > 1 ? interval_ / count : interval_;
+        return std::max(step, std::chrono::milliseconds(10));
+    }
+
+    // Poll the next connection and schedule the following tick
+    void OnMessage(rtc::Message*) override
+    {
+        if (!running_)
+            return;
+
+        rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
+        std::string uuid;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = peers_.upper_bound(cursor_);
+            if (it == peers_.end())
+                it = peers_.begin();
+            if (it != peers_.end())
+            {
+                uuid = it->first;
+                peer_connection = it->second.peer_connection;
+            }
+            cursor_ = uuid;
+        }
+
+        if (peer_connection)
+            peer_connection->GetStats(new rtc::RefCountedObject<callback>(this, alive_, uuid));
+
+        thread_->PostDelayed(RTC_FROM_HERE, static_cast<int>(tick().count()), this);
+    }
+
+    // Fold a stats report into the connection's sample
+    void fold(std::string const& uuid, webrtc::RTCStatsReport const& report)
+    {
+        peer_stats s;
+        s.sampled_at = std::chrono::steady_clock::now();
+
+        // Transport totals and the selected candidate pair
+        for (auto const* transport : report.GetStatsOfType<webrtc::RTCTransportStats>())
+        {
+            if (transport->bytes_sent.is_defined())
+                s.bytes_sent += *transport->bytes_sent;
+            if (transport->bytes_received.is_defined())
+                s.bytes_received += *transport->bytes_received;
+            if (!transport->selected_candidate_pair_id.is_defined())
+                continue;
+
+            auto const* pair_stats = report.Get(*transport->selected_candidate_pair_id);
+            if (!pair_stats)
+                continue;
+            auto const& pair = pair_stats->cast_to<webrtc::RTCIceCandidatePairStats>();
+            if (pair.current_round_trip_time.is_defined())
+                s.rtt_ms = *pair.current_round_trip_time * 1000.0;
+            if (pair.local_candidate_id.is_defined())
+                s.local_candidate = describe_candidate(report, *pair.local_candidate_id);
+            if (pair.remote_candidate_id.is_defined())
+                s.remote_candidate = describe_candidate(report, *pair.remote_candidate_id);
+        }
+
+        // Data channel message counts
+        for (auto const* channel : report.GetStatsOfType<webrtc::RTCDataChannelStats>())
+        {
+            if (channel->messages_sent.is_defined())
+                s.messages_sent += *channel->messages_sent;
+            if (channel->messages_received.is_defined())
+                s.messages_received += *channel->messages_received;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = peers_.find(uuid);
+        if (it == peers_.end())
+            return;
+        if (it->second.buffered_amount)
+            s.buffered_amount = it->second.buffered_amount();
+        it->second.stats = std::move(s);
+        it->second.sampled = true;
+    }
+
+    // "type ip:port/protocol" of a candidate in the report
+    static std::string describe_candidate(webrtc::RTCStatsReport const& report, std::string const& id)
+    {
+        auto const* stats = report.Get(id);
+        if (!stats ||
+            (stats->type() != webrtc::RTCLocalIceCandidateStats::kType &&
+             stats->type() != webrtc::RTCRemoteIceCandidateStats::kType))
+            return {};
+        auto const& candidate = static_cast<webrtc::RTCIceCandidateStats const&>(*stats);
+        std::string result;
+        if (candidate.candidate_type.is_defined())
+            result.append(*candidate.candidate_type).append(" ");
+        if (candidate.ip.is_defined())
+            result.append(*candidate.ip);
+        if (candidate.port.is_defined())
+            result.append(":").append(std::to_string(*candidate.port));
+        if (candidate.protocol.is_defined())
+            result.append("/").append(*candidate.protocol);
+        return result;
+    }
+};
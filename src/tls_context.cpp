@@ -0,0 +1,52 @@
+#include "tls_context.hpp"
+
+#if defined(SERVER_USE_TLS)
+
+#include <openssl/ssl.h>
+
+std::shared_ptr<net::ssl::context>
+make_tls_context(
+    std::string const& cert_file,
+    std::string const& key_file,
+    beast::error_code& ec)
+{
+    auto ctx = std::make_shared<net::ssl::context>(net::ssl::context::tls_server);
+
+    // TLS 1.2 and newer only
+    ctx->set_options(
+        net::ssl::context::default_workarounds |
+        net::ssl::context::no_sslv2 |
+        net::ssl::context::no_sslv3 |
+        net::ssl::context::no_tlsv1 |
+        net::ssl::context::no_tlsv1_1 |
+        net::ssl::context::single_dh_use, ec);
+    if (ec)
+        return nullptr;
+
+    ctx->use_certificate_chain_file(cert_file, ec);
+    if (ec)
+        return nullptr;
+
+    ctx->use_private_key_file(key_file, net::ssl::context::pem, ec);
+    if (ec)
+        return nullptr;
+
+    auto const native = ctx->native_handle();
+
+    // Session cache for clients resuming by session id (TLS 1.2)
+    static unsigned char const session_id_context[] = "local-webrtc-signaling";
+    SSL_CTX_set_session_id_context(native, session_id_context, sizeof(session_id_context) - 1);
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(native, 4096);
+    SSL_CTX_set_timeout(native, 2 * 60 * 60);
+
+    // Stateless session tickets, the usual resumption path of browsers
+    SSL_CTX_clear_options(native, SSL_OP_NO_TICKET);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    SSL_CTX_set_num_tickets(native, 2);
+#endif
+
+    return ctx;
+}
+
+#endif
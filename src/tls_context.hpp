@@ -0,0 +1,20 @@
+#pragma once
+
+#if defined(SERVER_USE_TLS)
+
+#include "beast.hpp"
+#include <boost/asio/ssl/context.hpp>
+#include <memory>
+#include <string>
+
+// Create the server TLS context from a PEM certificate chain and private key.
+// Session tickets and a server-side session cache are enabled, so a returning
+// client resumes its session instead of doing a full handshake.
+// Returns nullptr and sets ec on failure.
+std::shared_ptr<net::ssl::context>
+make_tls_context(
+    std::string const& cert_file,
+    std::string const& key_file,
+    beast::error_code& ec);
+
+#endif
@@ -1,31 +1,75 @@
 #pragma once
 
+#include "data_channel_framing.hpp"
+#include "memory_budget.hpp"
+#include "sdp.hpp"
+#include "send_scheduler.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <functional>
 #include <thread>
 #include <iostream>
+#include <vector>
 
 // WebRTC headers
 #include <webrtc/api/peerconnectioninterface.h>
 
+// Reliability, ordering and priority of one data channel
+struct data_channel_config
+{
+	std::string label;
+	bool ordered = true;
+
+	// -1 leaves the limit unset (fully reliable)
+	int max_retransmits = -1;
+	int max_retransmit_time_ms = -1;
+
+	// Queued messages of higher priority channels are sent first
+	int priority = 0;
+};
+
 class webrtc_connection
 {
 public:
+	// One named data channel of this connection
+	class channel;
+
 	// Connection name
 	const std::string uuid_;
 
-    //ICE candidates
-    std::vector<std::string> cadidates_;
+    //ICE candidates, at most max_candidates
+    static std::size_t constexpr max_candidates = 32;
+    std::vector<sdp_candidate> cadidates_;
 
 	// WebRTC connections;
 	rtc::scoped_refptr<webrtc::PeerConnectionInterface> peer_connection;
-	rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel;
+
+	// Latest ICE connection state, recorded on the signaling thread.
+	// Other threads read it here: asking the peer connection blocks on that thread.
+	std::atomic<webrtc::PeerConnectionInterface::IceConnectionState> ice_state{
+		webrtc::PeerConnectionInterface::kIceConnectionNew };
+
+	// Thread the observers are called on
+	rtc::Thread* const signaling_thread;
+
+	// Channel settings: the channels created with the connection,
+	// and the priorities of channels the remote peer opens
+	std::vector<data_channel_config> channel_configs;
+	coalescer_config coalescing;
+
+	// Orders outgoing messages across the channels
+	send_scheduler scheduler;
 
 	// Callbacks
     std::function<void(const webrtc::IceCandidateInterface* candidate)> on_ice_candidate;
 	std::function<void(webrtc::PeerConnectionInterface::IceConnectionState new_state)> on_ice_connection_change;
     std::function<void(webrtc::PeerConnectionInterface::IceGatheringState new_state)> on_ice_gathering_change;
-	std::function<void(const std::string&)> on_message;
+	std::function<void(channel&, const std::string&)> on_message;
+	std::function<void(channel&, rtc::ArrayView<const uint8_t>)> on_frame;
 
     // Observer classes
     class PCO : public webrtc::PeerConnectionObserver
@@ -43,14 +87,17 @@ public:
 
         void OnDataChannel(rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) override
         {
-            parent.data_channel = data_channel;
-            parent.data_channel->RegisterObserver(&parent.dco);
+            // Channels opened by the remote peer take the configured priority of their label
+            auto config = parent.config_for(data_channel->label());
+            config.ordered = data_channel->ordered();
+            parent.add_channel(data_channel, config);
         }
 
         void OnRenegotiationNeeded() override {}
 
         void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState new_state) override
         {
+            parent.ice_state = new_state;
             if (parent.on_ice_connection_change)
                 parent.on_ice_connection_change(new_state);
         }
@@ -71,19 +118,61 @@ public:
     class DCO : public webrtc::DataChannelObserver
     {
         webrtc_connection& parent;
+        channel& owner;
 
     public:
-        DCO(webrtc_connection& parent) : parent(parent) {}
+        DCO(webrtc_connection& parent, channel& owner) : parent(parent), owner(owner) {}
 
-        void OnStateChange() override {}
+        // Messages queued before the channel opened can go out now
+        void OnStateChange() override
+        {
+            parent.track_buffered(owner);
+            parent.scheduler.pump();
+        }
         
         void OnMessage(const webrtc::DataBuffer& buffer) override
         {
-            if (parent.on_message)
-                parent.on_message(std::string(buffer.data.data<char>(), buffer.data.size()));
+            // Binary messages carry length-prefixed frames, handed out as views into the buffer
+            if (buffer.binary)
+            {
+                if (parent.on_frame && !for_each_frame(buffer.data,
+                    [this](rtc::ArrayView<const uint8_t> frame) { parent.on_frame(owner, frame); }))
+                    std::cout << "Data Channel : malformed frame dropped" << std::endl;
+            }
+            else if (parent.on_message)
+                parent.on_message(owner, std::string(buffer.data.data<char>(), buffer.data.size()));
         }
 
-        void OnBufferedAmountChange(uint64_t previous_amount) override {}
+        // libwebrtc drained some of its buffer, so send more
+        void OnBufferedAmountChange(uint64_t previous_amount) override
+        {
+            parent.track_buffered(owner);
+            parent.scheduler.pump();
+        }
+    };
+
+    class channel
+    {
+    public:
+        data_channel_config const config;
+        rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel;
+        DCO dco;
+
+        // Batches outgoing binary frames on this channel
+        std::unique_ptr<message_coalescer> coalescer;
+
+        // Bytes libwebrtc buffers for this channel, as of its last change
+        std::atomic<std::uint64_t> buffered{ 0 };
+
+        channel(
+            webrtc_connection& parent,
+            data_channel_config const& config,
+            rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel) :
+            config(config),
+            data_channel(std::move(data_channel)),
+            dco(parent, *this)
+        {
+        }
     };
 
     class CSDO : public webrtc::CreateSessionDescriptionObserver
@@ -116,20 +205,184 @@ public:
 
     // Observer objects
     PCO pco;
-    DCO dco;
     rtc::scoped_refptr<CSDO> csdo;
     rtc::scoped_refptr<SSDO> ssdo;
 
     // Constructor
-    webrtc_connection(const std::string& uuid) :
+    webrtc_connection(
+        const std::string& uuid,
+        rtc::Thread* signaling_thread,
+        std::uint64_t buffered_limit = 64 * 1024,
+        std::uint64_t queue_limit = 4 * 1024 * 1024) :
         uuid_(uuid),
+        signaling_thread(signaling_thread),
+        scheduler(signaling_thread, buffered_limit, queue_limit),
         pco(*this),
-        dco(*this),
         csdo(new rtc::RefCountedObject<CSDO>(*this)),
         ssdo(new rtc::RefCountedObject<SSDO>(*this))
     {
     }
 
     // Deconstructor
-    ~webrtc_connection() {}
+    ~webrtc_connection()
+    {
+        close_channels();
+    }
+
+    // Return the configuration for a channel label, or a default one
+    data_channel_config config_for(const std::string& label) const
+    {
+        for (auto const& config : channel_configs)
+            if (config.label == label)
+                return config;
+        data_channel_config config;
+        config.label = label;
+        return config;
+    }
+
+    // Start tracking a data channel, replacing and closing any channel with the same label
+    channel& add_channel(
+        rtc::scoped_refptr<webrtc::DataChannelInterface> data_channel,
+        data_channel_config const& config)
+    {
+        remove_channel(config.label);
+
+        auto entry = std::make_unique<channel>(*this, config, data_channel);
+        entry->coalescer = std::make_unique<message_coalescer>(
+            [this, raw = data_channel.get()](const webrtc::DataBuffer& buffer)
+            {
+                scheduler.send(raw, buffer);
+            },
+            signaling_thread,
+            coalescing);
+        scheduler.add_channel(data_channel, config.priority);
+        data_channel->RegisterObserver(&entry->dco);
+        ++channel_count_;
+
+        std::lock_guard<std::mutex> lock(channels_mutex_);
+        auto& result = *entry;
+        channels_[config.label] = std::move(entry);
+        return result;
+    }
+
+    // Stop tracking a data channel and close it
+    void remove_channel(const std::string& label)
+    {
+        std::unique_ptr<channel> entry;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex_);
+            auto it = channels_.find(label);
+            if (it == channels_.end())
+                return;
+            entry = std::move(it->second);
+            channels_.erase(it);
+        }
+        release(*entry);
+        entry->data_channel->Close();
+    }
+
+    // Stop tracking every data channel
+    void close_channels()
+    {
+        std::map<std::string, std::unique_ptr<channel>> channels;
+        {
+            std::lock_guard<std::mutex> lock(channels_mutex_);
+            channels.swap(channels_);
+        }
+        for (auto& entry : channels)
+            release(*entry.second);
+    }
+
+    // Queue a message on the named channel, in priority order with the other channels
+    bool send(const std::string& label, const webrtc::DataBuffer& buffer)
+    {
+        std::lock_guard<std::mutex> lock(channels_mutex_);
+        auto it = channels_.find(label);
+        if (it == channels_.end())
+            return false;
+        return scheduler.send(it->second->data_channel.get(), buffer);
+    }
+
+    // Bytes waiting to be sent, in libwebrtc and in the scheduler queues.
+    // libwebrtc's share is the amount last reported to the observers,
+    // so this never waits for the signaling thread.
+    std::uint64_t buffered_amount()
+    {
+        return scheduler.queued_bytes() + buffered_bytes_;
+    }
+
+    // Record the buffered amount of a channel. Called on the signaling thread.
+    void track_buffered(channel& entry)
+    {
+        auto const amount = entry.data_channel->buffered_amount();
+        buffered_bytes_ += amount - entry.buffered.exchange(amount);
+    }
+
+    // Keep a candidate for the answer, returns false once max_candidates are kept
+    bool add_candidate(int mline_index, std::string candidate)
+    {
+        if (cadidates_.size() >= max_candidates)
+            return false;
+        candidate_bytes_ += sizeof(sdp_candidate) + candidate.capacity();
+        cadidates_.push_back(sdp_candidate{ mline_index, std::move(candidate) });
+        return true;
+    }
+
+    // Drop the candidates and their memory
+    void clear_candidates()
+    {
+        cadidates_.clear();
+        cadidates_.shrink_to_fit();
+        candidate_bytes_ = 0;
+    }
+
+    // Memory held for this connection. libwebrtc's share is the fixed estimate
+    // while the connection is up, the data channels are counted with the messages
+    // queued on them. Only reads counters, so it is safe under any lock.
+    peer_footprint footprint()
+    {
+        peer_footprint result;
+        result.uuid = uuid_;
+        auto const state = ice_state.load();
+        if (state != webrtc::PeerConnectionInterface::kIceConnectionClosed &&
+            state != webrtc::PeerConnectionInterface::kIceConnectionFailed)
+            result.peer_connection = peer_connection_estimate;
+        result.peer_connection += sizeof(*this) + candidate_bytes_;
+
+        result.data_channels = buffered_amount() +
+            channel_count_ * (sizeof(channel) + sizeof(message_coalescer));
+        return result;
+    }
+
+private:
+    // This mutex synchronizes access to channels_
+    std::mutex channels_mutex_;
+    std::map<std::string, std::unique_ptr<channel>> channels_;
+
+    // Bytes held by cadidates_, readable from any thread
+    std::atomic<std::size_t> candidate_bytes_{ 0 };
+
+    // Sum of the channels' buffered amounts, and the number of channels
+    std::atomic<std::uint64_t> buffered_bytes_{ 0 };
+    std::atomic<std::size_t> channel_count_{ 0 };
+
+    // May be called on any thread. The observer goes first: unregistering runs on the
+    // signaling thread, so it waits for a callback that is still using the channel.
+    // The coalescer's flush timer and on_frame also run there, so the pending batch
+    // is flushed and the coalescer destroyed there too.
+    void release(channel& entry)
+    {
+        entry.data_channel->UnregisterObserver();
+        signaling_thread->Invoke<void>(RTC_FROM_HERE, [this, &entry]
+            {
+                if (entry.coalescer)
+                    entry.coalescer->flush();
+                entry.coalescer = nullptr;
+                scheduler.remove_channel(entry.data_channel.get());
+            });
+
+        // No observer call updates the amount after it is unregistered
+        buffered_bytes_ -= entry.buffered.exchange(0);
+        --channel_count_;
+    }
 };
\ No newline at end of file
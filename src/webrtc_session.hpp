@@ -7,6 +7,9 @@
 #pragma comment(lib, "msdmo.lib")
 #pragma comment(lib, "Strmiids.lib")
 
+#include "shared_state.hpp"
+#include "startup_phase.hpp"
+#include "stats_collector.hpp"
 #include "webrtc_connection.hpp"
 
 #include <string>
@@ -16,6 +19,8 @@
 #include <webrtc/rtc_base/thread.h>
 #include <webrtc/api/audio_codecs/builtin_audio_encoder_factory.h>
 #include <webrtc/api/audio_codecs/builtin_audio_decoder_factory.h>
+#include <webrtc/rtc_base/rtccertificate.h>
+#include <webrtc/rtc_base/sslidentity.h>
 
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
@@ -34,40 +39,71 @@ class webrtc_session
 
 	rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peer_connection_factory;
 	webrtc::PeerConnectionInterface::RTCConfiguration peer_connection_config;
+	coalescer_config coalescer_config_;
+	std::vector<data_channel_config> data_channel_configs_;
 	std::unique_ptr<webrtc_connection> connection;
 
+	// Samples the stats of the live peer connections
+	std::unique_ptr<stats_collector> stats_;
+
 public:
 	// Constructor
-	webrtc_session(std::shared_ptr<shared_state> const& state) : state_(state)
+	webrtc_session(
+		std::shared_ptr<shared_state> const& state,
+		warm_up_options const& options = warm_up_options{}) : state_(state)
 	{
 		std::cout << std::this_thread::get_id() << ":"
 			<< "Create webrtc_session" << std::endl;
 
+		// Default data channels: reliable control messages ahead of the unreliable "dc" channel
+		data_channel_config control;
+		control.label = "control";
+		control.priority = 1;
+		data_channel_configs_.push_back(control);
+
+		data_channel_config dc;
+		dc.label = "dc";
+		dc.ordered = false;
+		dc.max_retransmits = 0;
+		data_channel_configs_.push_back(dc);
+
 		// Initialize
-		rtc::InitializeSSL();
-		rtc::InitRandom(rtc::Time());
-		rtc::ThreadManager::Instance()->WrapCurrentThread();
+		startup_phase("initialize ssl", []
+			{
+				rtc::InitializeSSL();
+				rtc::InitRandom(rtc::Time());
+				rtc::ThreadManager::Instance()->WrapCurrentThread();
+			});
 
 		// Create threads
-		network_thread = rtc::Thread::CreateWithSocketServer();
-		network_thread->Start();
-		worker_thread = rtc::Thread::Create();
-		worker_thread->Start();
-		signaling_thread = rtc::Thread::Create();
-		signaling_thread->Start();
+		startup_phase("create threads", [this]
+			{
+				network_thread = rtc::Thread::CreateWithSocketServer();
+				network_thread->Start();
+				worker_thread = rtc::Thread::Create();
+				worker_thread->Start();
+				signaling_thread = rtc::Thread::Create();
+				signaling_thread->Start();
+			});
 
 		// Create Audio Encoder/Decoder and Peer Connection Factories
-		audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
-		audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
-		peer_connection_factory = webrtc::CreatePeerConnectionFactory(
-			network_thread.get(),
-			worker_thread.get(),
-			signaling_thread.get(),
-			nullptr,
-			audio_encoder_factory,
-			audio_decoder_factory,
-			nullptr,
-			nullptr);
+		startup_phase("create codec factories", [this]
+			{
+				audio_encoder_factory = webrtc::CreateBuiltinAudioEncoderFactory();
+				audio_decoder_factory = webrtc::CreateBuiltinAudioDecoderFactory();
+			});
+		startup_phase("create peer connection factory", [this]
+			{
+				peer_connection_factory = webrtc::CreatePeerConnectionFactory(
+					network_thread.get(),
+					worker_thread.get(),
+					signaling_thread.get(),
+					nullptr,
+					audio_encoder_factory,
+					audio_decoder_factory,
+					nullptr,
+					nullptr);
+			});
 
 		// If Peer Connection Factory creation failed, exit
 		if (peer_connection_factory.get() == nullptr)
@@ -76,6 +112,28 @@ public:
 				<< "Error on CreateModularPeerConnectionFactory." << std::endl;
 			exit(EXIT_FAILURE);
 		}
+
+		// Query the codec factories so their tables are built now, not on the first offer
+		if (options.prewarm_codecs)
+			startup_phase("prewarm codecs", [this]
+				{
+					audio_encoder_factory->GetSupportedEncoders();
+					audio_decoder_factory->GetSupportedDecoders();
+				});
+
+		// Start sampling peer connection stats
+		stats_ = std::make_unique<stats_collector>(signaling_thread.get(), options.stats_interval);
+		stats_->start();
+
+		// Generate the DTLS certificate once, instead of once per peer connection
+		if (options.generate_certificate)
+			startup_phase("generate certificate", [this]
+				{
+					auto certificate = rtc::RTCCertificate::Create(std::unique_ptr<rtc::SSLIdentity>(
+						rtc::SSLIdentity::Generate("webrtc", rtc::KT_ECDSA)));
+					if (certificate)
+						peer_connection_config.certificates.push_back(certificate);
+				});
 	}
 
 	~webrtc_session()
@@ -87,13 +145,45 @@ public:
 	void on_ice_candidate(std::function<void(const webrtc::IceCandidateInterface* candidate)> f) { connection->on_ice_candidate = f; }
 	void on_ice_connection_change(std::function<void(webrtc::PeerConnectionInterface::IceConnectionState)> f) { connection->on_ice_connection_change = f; }
 	void on_ice_gathering_change(std::function<void(webrtc::PeerConnectionInterface::IceGatheringState)> f) { connection->on_ice_gathering_change = f; }
-	void on_message(std::function<void(const std::string&)> f) { connection->on_message = f; }
+	void on_message(std::function<void(webrtc_connection::channel&, const std::string&)> f) { connection->on_message = f; }
+	void on_frame(std::function<void(webrtc_connection::channel&, rtc::ArrayView<const uint8_t>)> f) { connection->on_frame = f; }
+
+	// Set the flush policy used for data channels created after this call
+	void set_coalescer_config(coalescer_config const& config) { coalescer_config_ = config; }
+
+	// Stats of the live peer connections
+	stats_collector const& stats() const { return *stats_; }
+
+	// Set the data channels opened with each new connection
+	void set_data_channel_configs(std::vector<data_channel_config> const& configs) { data_channel_configs_ = configs; }
+
+	// Memory held for each peer connection
+	std::vector<peer_footprint> footprints() const
+	{
+		std::vector<peer_footprint> result;
+		if (connection)
+			result.push_back(connection->footprint());
+		return result;
+	}
+
+	// Number of peer connections that are still up.
+	// Called under shared_state's mutex, so it must not wait for the signaling thread.
+	std::size_t connection_count() const
+	{
+		if (!connection)
+			return 0;
+		auto const state = connection->ice_state.load();
+		return state == webrtc::PeerConnectionInterface::kIceConnectionClosed ||
+			state == webrtc::PeerConnectionInterface::kIceConnectionFailed ? 0 : 1;
+	}
 
 	// Create new Peer Connection and Data Channel
 	void create_connection(std::string const& offer_payload)
 	{
 		if (!connection)
-			connection = std::make_unique<webrtc_connection>("uuid");
+			connection = std::make_unique<webrtc_connection>("uuid", signaling_thread.get());
+		connection->channel_configs = data_channel_configs_;
+		connection->coalescing = coalescer_config_;
 
 		// Set ICE gathering state change handler
 		on_ice_gathering_change([this](webrtc::PeerConnectionInterface::IceGatheringState new_state)
@@ -106,25 +196,22 @@ public:
 					// Get local session description
 					auto local_sdp = connection->peer_connection->local_description();
 
-					// Add new ICE candidate to the sdp (one candidate for local connection)
+					// Add the ICE candidates to their m-sections of the sdp
 					std::string sdp_str;
 					local_sdp->ToString(&sdp_str);
-					for (auto candidate : connection->cadidates_)
-					{
-						sdp_str.append("a=");
-						sdp_str.append(candidate);
-						sdp_str.append("\r\n");
-					}
+					auto const answer = build_answer(sdp_str, connection->cadidates_);
 
 					// Create payload
-					rapidjson::Document message_object;
-					message_object.SetObject();
-					message_object.AddMember("type", "answer", message_object.GetAllocator());
-					message_object.AddMember("sdp", rapidjson::StringRef(sdp_str.c_str()), message_object.GetAllocator());
 					rapidjson::StringBuffer strbuf;
+					strbuf.Reserve(answer.size() + answer.size() / 8 + 32);
 					rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
-					message_object.Accept(writer);
-					std::string payload = strbuf.GetString();
+					writer.StartObject();
+					writer.Key("type");
+					writer.String("answer");
+					writer.Key("sdp");
+					writer.String(answer.c_str(), static_cast<rapidjson::SizeType>(answer.size()));
+					writer.EndObject();
+					std::string payload(strbuf.GetString(), strbuf.GetSize());
 
 					// Set answer payload, answer ready state
 					state_->set_answer_payload(payload);
@@ -138,7 +225,7 @@ public:
 				// Add new candidates to the contatiner in webrtc_connection
 				std::string candidate_str;
 				candidate->ToString(&candidate_str);
-				connection->cadidates_.push_back(candidate_str);
+				connection->add_candidate(candidate->sdp_mline_index(), std::move(candidate_str));
 			});
 
 		// Set ICE state change(unexpected disconnection) handler
@@ -171,32 +258,47 @@ public:
 				case webrtc::PeerConnectionInterface::IceConnectionState::kIceConnectionClosed:
 				{
 					std::cout << "IceConnectionState::kIceConnectionClosed" << std::endl;
-					connection->cadidates_.clear();
+					connection->clear_candidates();
 					break;
 				}
 				}
 			});
 
 		// Set data channel message handler
-		on_message([this](const std::string& received_message)
+		on_message([this](webrtc_connection::channel& channel, const std::string& received_message)
 			{
-				std::cout << "Data Channel : " << received_message << std::endl;
-				std::string payload = received_message;
-				webrtc::DataBuffer send_message(payload);
-				if (connection->data_channel)
-					connection->data_channel->Send(send_message);
+				std::cout << "Data Channel(" << channel.config.label << ") : " << received_message << std::endl;
+				webrtc::DataBuffer send_message(received_message);
+				connection->send(channel.config.label, send_message);
+			});
+
+		// Set binary frame handler (frames are echoed back in coalesced batches)
+		on_frame([](webrtc_connection::channel& channel, rtc::ArrayView<const uint8_t> frame)
+			{
+				if (channel.coalescer)
+					channel.coalescer->send(frame.data(), frame.size());
 			});
 
 		// Create Peer Connection
+		connection->ice_state = webrtc::PeerConnectionInterface::kIceConnectionNew;
 		connection->peer_connection = peer_connection_factory
 			->CreatePeerConnection(peer_connection_config, nullptr, nullptr, &connection->pco);
+		stats_->add(connection->uuid_, connection->peer_connection, [conn = connection.get()]
+			{
+				return conn->buffered_amount();
+			});
 		
-		// Create Data Channel
-		webrtc::DataChannelInit data_channel_config;
-		data_channel_config.ordered = false;
-		data_channel_config.maxRetransmits = 0;
-		connection->data_channel = connection->peer_connection->CreateDataChannel("dc", &data_channel_config);
-		connection->data_channel->RegisterObserver(&connection->dco);
+		// Create Data Channels
+		for (auto const& config : data_channel_configs_)
+		{
+			webrtc::DataChannelInit data_channel_config;
+			data_channel_config.ordered = config.ordered;
+			data_channel_config.maxRetransmits = config.max_retransmits;
+			data_channel_config.maxRetransmitTime = config.max_retransmit_time_ms;
+			connection->add_channel(
+				connection->peer_connection->CreateDataChannel(config.label, &data_channel_config),
+				config);
+		}
 		
 		// TODO : Local MediaStreamTracks & AddStream
 
@@ -209,8 +311,13 @@ public:
 	}
 
     void quit() {
-		connection->peer_connection = nullptr;
-		connection->data_channel = nullptr;
+		stats_->stop();
+		if (connection)
+		{
+			stats_->remove(connection->uuid_);
+			connection->close_channels();
+			connection->peer_connection = nullptr;
+		}
         peer_connection_factory = nullptr;
 
         network_thread->Stop();